@@ -12,6 +12,11 @@ const lib_sources = [_][]const u8{
     "src/lib/hash_table.cpp",
     "src/lib/file_backed_buffer.cpp",
     "src/lib/file_backed_buffer_diagrammer.cpp",
+    "src/lib/write_ahead_log.cpp",
+    "src/lib/handoff.cpp",
+    "src/lib/crc32c.cpp",
+    "src/lib/huge_pages.cpp",
+    "src/lib/sharded_store.cpp",
 };
 
 pub fn build(b: *std.Build) void {
@@ -81,6 +86,33 @@ pub fn buildTests(
     stress_test.linkLibrary(dep);
     b.installArtifact(stress_test);
 
+    // Create the benchmark of the library
+    const benchmark = b.addExecutable(.{
+        .name = "kv_benchmark",
+        .target = target,
+        .optimize = optimize,
+    });
+    benchmark.addCSourceFile(.{ .file = b.path("src/tester/benchmark.cpp"), .flags = &cpp_flags });
+    benchmark.addIncludePath(b.path("src/lib/"));
+    benchmark.linkLibrary(dep);
+    b.installArtifact(benchmark);
+
+    // Create the tool that restores a store file from incremental backups
+    const restore_backup = b.addExecutable(.{
+        .name = "kv_restore_backup",
+        .target = target,
+        .optimize = optimize,
+    });
+    restore_backup.addCSourceFile(.{ .file = b.path("src/tools/restore_backup.cpp"), .flags = &cpp_flags });
+    restore_backup.addIncludePath(b.path("src/lib/"));
+    restore_backup.linkLibrary(dep);
+    b.installArtifact(restore_backup);
+
+    const bench_cmd = b.addRunArtifact(benchmark);
+    bench_cmd.step.dependOn(b.getInstallStep());
+    const bench_step = b.step("bench", "Run the benchmark");
+    bench_step.dependOn(&bench_cmd.step);
+
     // This *creates* a Run step in the build graph, to be executed when another
     // step is evaluated that depends on it. The next line below will establish
     // such a dependency.
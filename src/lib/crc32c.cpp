@@ -0,0 +1,75 @@
+#include <cstring>
+#include <array>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.hpp"
+
+
+// reflected form of the Castagnoli polynomial
+constexpr uint32_t CRC32C_POLYNOMIAL = 0x82f63b78;
+
+static constexpr std::array<uint32_t, 256> make_crc32c_table()
+{
+  std::array<uint32_t, 256> table = {};
+  for (uint32_t i = 0; i < table.size(); ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+static constexpr std::array<uint32_t, 256> CRC32C_TABLE = make_crc32c_table();
+
+uint32_t crc32c_software(const void * data, const size_t size, const uint32_t crc)
+{
+  const uint8_t * bytes = static_cast<const uint8_t *>(data);
+  uint32_t result = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    result = CRC32C_TABLE[(result ^ bytes[i]) & 0xff] ^ (result >> 8);
+  }
+  return ~result;
+}
+
+#if defined(__x86_64__)
+// compiled for SSE4.2 on its own, so that the rest of the library still runs on CPUs without it
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(const void * data, const size_t size, const uint32_t crc)
+{
+  const uint8_t * bytes = static_cast<const uint8_t *>(data);
+  const uint8_t * end = bytes + size;
+  uint64_t result = ~crc;
+  for (; bytes + sizeof(uint64_t) <= end; bytes += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    result = _mm_crc32_u64(result, word);
+  }
+  for (; bytes < end; ++bytes) {
+    result = _mm_crc32_u8(static_cast<uint32_t>(result), *bytes);
+  }
+  return ~static_cast<uint32_t>(result);
+}
+#endif
+
+using Crc32cFunction = uint32_t (*)(const void *, const size_t, const uint32_t);
+
+static Crc32cFunction select_crc32c()
+{
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2")) {
+    return crc32c_sse42;
+  }
+#endif
+  return crc32c_software;
+}
+
+uint32_t crc32c(const void * data, const size_t size, const uint32_t crc)
+{
+  static const Crc32cFunction implementation = select_crc32c();
+  return implementation(data, size, crc);
+}
@@ -0,0 +1,14 @@
+#ifndef _CRC32C_HPP_
+#define _CRC32C_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli), using the SSE4.2 crc32 instruction when the CPU has it and a lookup table otherwise
+// crc is the result of a previous call, to continue a checksum over more data
+uint32_t crc32c(const void * data, const size_t size, const uint32_t crc = 0);
+
+// the lookup table version, for checking the hardware version against
+uint32_t crc32c_software(const void * data, const size_t size, const uint32_t crc = 0);
+
+#endif  // _CRC32C_HPP_
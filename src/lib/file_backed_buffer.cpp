@@ -3,78 +3,165 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <cassert>
+#include <algorithm>
 #include <limits>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
 
 #include "file_backed_buffer.hpp"
+#include "huge_pages.hpp"
 
 
-static int get_file_size(int fd)
+constexpr uint64_t BUFFER_MAGIC = 0x3130306275666b76;  // "kvfub001"
+
+// every block is sized to a multiple of this, so that block headers and the start of every allocation are aligned
+constexpr size_t ALIGNMENT = alignof(uint64_t);
+
+static size_t align_up(const size_t size)
+{
+  return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+// 0 if it can't be found, which fails the mapping
+static size_t get_file_size(int fd)
 {
   struct stat stat_buf;
   if (fstat(fd, &stat_buf) < 0) {
     int err = errno;
     std::cerr << "[ERROR] " << strerror(err) << '\n';
-    return -1;
+    return 0;
   } else {
-    return stat_buf.st_size;
+    return static_cast<size_t>(stat_buf.st_size);
   }
 }
 
-FileBackedBuffer::FileBackedBuffer(const char * filename, const size_t buffer_size) : m_fd(-1), m_base(nullptr)
+// hugetlbfs files can only be mapped in whole huge pages, which is their block size
+bool FileBackedBuffer::on_hugetlbfs(const int fd)
+{
+  struct statfs statfs_buf;
+  if (fd < 0 || fstatfs(fd, &statfs_buf) != 0 || statfs_buf.f_type != HUGETLBFS_MAGIC) {
+    return false;
+  }
+  m_page_size = statfs_buf.f_bsize;
+  return true;
+}
+
+FileBackedBuffer::FileBackedBuffer(const char * filename, const size_t buffer_size, const int fd, const Pages pages) :
+  m_fd(fd), m_base(nullptr), m_volatile(filename == nullptr), m_pages(pages), m_page_size(sysconf(_SC_PAGESIZE)), m_num_synced_pages(0), m_num_copied_pages(0), m_longest_copy_pause(0),
+  m_copy_session(std::random_device()() | static_cast<uint64_t>(std::random_device()()) << 32), m_copy_sequence(0),
+  m_pending_punch_size(0), m_closing(false), m_can_punch(true), m_num_punched_holes(0), m_num_punched_bytes(0),
+  m_stop_residency(false), m_prefetch_large_reads(false), m_track_reads(false), m_num_warmed_bytes(0),
+  m_num_deactivated_regions(0)
 {
   bool new_file = false;
 
-  std::cout << "[INFO] attempting to create buffer file\n";
-  m_fd = open(filename, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-  if (m_fd < 0) {
-    if (errno == EEXIST) {
-      std::cout << "[INFO] buffer file already exists\n";
-      m_fd = open(filename, O_RDWR);
-      if (m_fd < 0) {
-        int err = errno;
-        std::cerr << "[ERROR] " << strerror(err) << '\n';
+  if (m_fd >= 0) {
+    std::cout << "[INFO] using the handed over buffer file\n";
+  } else if (m_volatile) {
+    // the same mapping as for a file, so everything else works the same, without the file's writeback
+    std::cout << "[INFO] creating volatile buffer in memory\n";
+    m_fd = memfd_create("kvstore", MFD_CLOEXEC);
+    if (m_fd < 0) {
+      int err = errno;
+      std::cerr << "[ERROR] " << strerror(err) << '\n';
+    } else {
+      new_file = true;
+      if (ftruncate(m_fd, buffer_size) != 0) {
+        std::cerr << "[WARN] failed to resize volatile buffer to " << buffer_size << " bytes\n";
       }
     }
   } else {
-    new_file = true;
-    if (ftruncate(m_fd, buffer_size) != 0) {
-      std::cerr << "[WARN] failed to resize buffer file to " << buffer_size << " bytes\n";
+    std::cout << "[INFO] attempting to create buffer file\n";
+    m_fd = open(filename, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    if (m_fd < 0) {
+      if (errno == EEXIST) {
+        std::cout << "[INFO] buffer file already exists\n";
+        m_fd = open(filename, O_RDWR);
+        if (m_fd < 0) {
+          int err = errno;
+          std::cerr << "[ERROR] " << strerror(err) << '\n';
+        }
+      }
+    } else {
+      new_file = true;
+      if (ftruncate(m_fd, on_hugetlbfs(m_fd) ? (buffer_size + m_page_size - 1) / m_page_size * m_page_size : buffer_size) != 0) {
+        std::cerr << "[WARN] failed to resize buffer file to " << buffer_size << " bytes\n";
+      }
     }
   }
 
   m_db_size = get_file_size(m_fd);
   std::cout << "[INFO] buffer file size: " << m_db_size << " bytes\n";
 
+  if (m_fd >= 0 && on_hugetlbfs(m_fd)) {
+    // the mapping is made of huge pages whatever was asked for, and they're the unit of everything the buffer does per page
+    m_pages = Pages::HUGETLBFS;
+    std::cout << "[INFO] buffer file is on hugetlbfs, with " << m_page_size << " byte pages\n";
+  }
+
   if (m_fd >= 0) {
     // using an mmap'd file to provide easy to use interface for client code
-    m_base = static_cast<uint8_t *>(mmap(NULL, m_db_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0));
+    if (m_pages == Pages::TRANSPARENT_HUGE) {
+      m_base = static_cast<uint8_t *>(map_huge(m_db_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0));
+    } else {
+      m_base = static_cast<uint8_t *>(mmap(NULL, m_db_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0));
+    }
     if (m_base == MAP_FAILED) {
-      std::cerr << "[ERROR] mmaping " << filename << " failed\n";
+      std::cerr << "[ERROR] mmaping " << (m_volatile ? "volatile buffer" : filename) << " failed\n";
       m_base = nullptr;
     }
   }
   assert(m_base != nullptr);
+  m_dirty_pages = std::vector<std::atomic<uint64_t>>((m_db_size / m_page_size + 1 + 63) / 64);
+  m_copy_dirty_pages = std::vector<std::atomic<uint64_t>>(m_dirty_pages.size());
+  const size_t num_regions = (m_db_size + RESIDENCY_REGION_SIZE - 1) / RESIDENCY_REGION_SIZE;
+  m_read_regions = std::vector<std::atomic<uint64_t>>((num_regions + 63) / 64);
+  m_cold_regions = std::vector<bool>(num_regions);
 
   // initialize the buffer
   m_header = reinterpret_cast<BufferHeader *>(m_base);
   if (m_header != nullptr && new_file) {
     std::cout << "[INFO] initializing buffer file contents\n";
+    m_header->magic = BUFFER_MAGIC;
+    m_header->root_block_offset = NULL_OFFSET;
     free_list() = sizeof(BufferHeader);
     used_list() = NULL_OFFSET;
 
     Block * new_block = reinterpret_cast<Block *>(to_pointer(free_list()));
-    new_block->data_size = m_db_size - sizeof(BufferHeader) - sizeof(Block);
+    new_block->data_size = (m_db_size & ~(ALIGNMENT - 1)) - sizeof(BufferHeader) - sizeof(Block);
     new_block->prev_block_offset = NULL_OFFSET;
     new_block->next_block_offset = NULL_OFFSET;
+    mark_dirty(m_header, sizeof(BufferHeader));
+    mark_block_dirty(new_block);
+  } else if (m_header != nullptr && m_header->magic != BUFFER_MAGIC) {
+    std::cerr << "[ERROR] " << (m_volatile ? "volatile buffer" : filename) << " was not created by this version of the buffer, delete it to start over\n";
+    assert(false);
   }
+
+  m_puncher = std::thread(&FileBackedBuffer::punch_holes_in_background, this);
 }
 
 FileBackedBuffer::~FileBackedBuffer()
 {
+  {
+    std::unique_lock<std::mutex> punch_lock(m_punch_mutex);
+    m_closing = true;
+  }
+  m_punch_requested.notify_one();
+  if (m_puncher.joinable()) {
+    m_puncher.join();
+  }
+  set_residency(Residency());
+
   if (m_base != nullptr) {
     munmap(m_base, m_db_size);
   }
@@ -83,35 +170,23 @@ FileBackedBuffer::~FileBackedBuffer()
   }
 }
 
+void FileBackedBuffer::set_allocator_params(const AllocatorParams & params)
+{
+  std::unique_lock<std::mutex> write_lock(m_mutex);
+  m_allocator_params = params;
+}
+
 uint8_t * FileBackedBuffer::alloc(const size_t alloc_size)
 {
   std::unique_lock<std::mutex> write_lock(m_mutex);
 
   uint8_t * result = nullptr;
 
-  FileByteOffset curr_free_block_offset = free_list();
-  while (curr_free_block_offset != NULL_OFFSET) {
-    Block * curr_block = reinterpret_cast<Block *>(to_pointer(curr_free_block_offset));
-    if (curr_block->data_size >= alloc_size) {
-      remove_block_from_list(free_list(), curr_block);
-
-      // if the size of the currently available block is >100 bytes greater than the requested size
-      // then split the currently available block into two. >100 bytes is a heurestic
-      if (curr_block->data_size >= alloc_size + sizeof(Block) + 100) {
-        Block * split_block = reinterpret_cast<Block *>(curr_block->data + alloc_size);
-        split_block->data_size = curr_block->data_size - alloc_size - sizeof(Block);
-        insert_block_to_free_list(split_block);
-        curr_block->data_size = alloc_size;
-      }
-
-      insert_block_to_used_list(curr_block);
-
-      result = curr_block->data;
-      // *result = '\0'; // perform a non-comprehensive but cheap data reset
-      break;
-    }
-
-    curr_free_block_offset = curr_block->next_block_offset;
+  Block * free_block = find_free_block(align_up(alloc_size), write_lock);
+  if (free_block != nullptr) {
+    carve_block(free_block, align_up(alloc_size));
+    insert_block_to_used_list(free_block);
+    result = free_block->data;
   }
 
   if (result == nullptr) {
@@ -125,9 +200,285 @@ uint8_t * FileBackedBuffer::alloc(const size_t alloc_size)
 void FileBackedBuffer::free(const uint8_t * pointer)
 {
   std::unique_lock<std::mutex> write_lock(m_mutex);
-  Block * block = const_cast<Block *>(reinterpret_cast<const Block *>(pointer - sizeof(Block)));
+  release_block(const_cast<Block *>(reinterpret_cast<const Block *>(pointer - sizeof(Block))));
+}
+
+std::vector<uint8_t *> FileBackedBuffer::alloc_batch(const std::vector<size_t> & alloc_sizes, const bool all_or_nothing)
+{
+  std::unique_lock<std::mutex> write_lock(m_mutex);
+
+  std::vector<uint8_t *> results(alloc_sizes.size(), nullptr);
+  if (alloc_sizes.empty()) {
+    return results;
+  }
+
+  // enough room to split off every block but the last, so that they all end up contiguous
+  size_t contiguous_size = align_up(alloc_sizes.back());
+  for (size_t i = 0; i + 1 < alloc_sizes.size(); ++i) {
+    contiguous_size += align_up(alloc_sizes[i]) + sizeof(Block) + m_allocator_params.split_threshold;
+  }
+
+  Block * free_block = find_free_block(contiguous_size, write_lock);
+  if (free_block != nullptr) {
+    for (size_t i = 0; i < alloc_sizes.size(); ++i) {
+      Block * remainder = carve_block(free_block, align_up(alloc_sizes[i]));
+      insert_block_to_used_list(free_block);
+      results[i] = free_block->data;
+      free_block = remainder;
+    }
+    return results;
+  }
+
+  size_t num_failed = 0;
+  for (size_t i = 0; i < alloc_sizes.size(); ++i) {
+    free_block = find_free_block(align_up(alloc_sizes[i]), write_lock);
+    if (free_block == nullptr) {
+      ++num_failed;
+      if (all_or_nothing) {
+        break;
+      }
+      continue;
+    }
+    carve_block(free_block, align_up(alloc_sizes[i]));
+    insert_block_to_used_list(free_block);
+    results[i] = free_block->data;
+  }
+
+  if (num_failed > 0) {
+    std::cerr << "[WARN] Failed to allocate " << num_failed << " of " << alloc_sizes.size() << " blocks in batch\n";
+    if (all_or_nothing) {
+      for (uint8_t * & result : results) {
+        if (result != nullptr) {
+          release_block(reinterpret_cast<Block *>(result - sizeof(Block)));
+          result = nullptr;
+        }
+      }
+    }
+  }
+
+  return results;
+}
+
+FileBackedBuffer::Block * FileBackedBuffer::find_free_block(const size_t min_size, std::unique_lock<std::mutex> & write_lock)
+{
+  while (true) {
+    bool skipped_punching_block = false;
+    FileByteOffset curr_free_block_offset = m_header->next_free_block_offset;
+    while (curr_free_block_offset != NULL_OFFSET) {
+      Block * curr_block = reinterpret_cast<Block *>(to_pointer(curr_free_block_offset));
+      if (curr_block->data_size >= min_size) {
+        // carve_block() writes the front of the block, up to the header of the remainder it splits off, if any
+        const FileByteOffset data_offset = to_offset(curr_block->data);
+        const FileByteOffset carved_end = data_offset + std::min(curr_block->data_size,
+                                                                 min_size + sizeof(Block) + m_allocator_params.split_threshold);
+        const bool punching = std::any_of(m_punching_holes.begin(), m_punching_holes.end(),
+                                          [curr_free_block_offset, carved_end](const std::pair<FileByteOffset, FileByteOffset> & hole) {
+                                            return hole.first < carved_end && curr_free_block_offset < hole.second;
+                                          });
+        if (!punching) {
+          return curr_block;
+        }
+        skipped_punching_block = true;
+      }
+      curr_free_block_offset = curr_block->next_block_offset;
+    }
+    if (!skipped_punching_block) {
+      return nullptr;
+    }
+    m_holes_punched.wait(write_lock);
+  }
+}
+
+uint8_t * FileBackedBuffer::alloc_root(const size_t alloc_size)
+{
+  std::unique_lock<std::mutex> write_lock(m_mutex);
+  assert(m_header->root_block_offset == NULL_OFFSET);
+
+  Block * free_block = find_free_block(align_up(alloc_size), write_lock);
+  if (free_block == nullptr) {
+    std::cerr << "[WARN] Failed to allocate " << alloc_size << " bytes for root block\n";
+    return nullptr;
+  }
+  carve_block(free_block, align_up(alloc_size));
+  m_header->root_block_offset = to_offset(free_block);
+  mark_dirty(m_header, sizeof(BufferHeader));
+  return free_block->data;
+}
+
+size_t FileBackedBuffer::size_for_root(const size_t root_size)
+{
+  return sizeof(BufferHeader) + sizeof(Block) + align_up(root_size);
+}
+
+// takes free_block off the free list, splitting off and returning what it doesn't need for alloc_size, if that's more
+// than split_threshold bytes (100 by default, a heurestic) besides the split block's header
+// the caller decides which list, if any, the carved block goes on
+FileBackedBuffer::Block * FileBackedBuffer::carve_block(Block * free_block, const size_t alloc_size)
+{
+  remove_block_from_list(free_list(), free_block);
+
+  Block * split_block = nullptr;
+  if (free_block->data_size >= alloc_size + sizeof(Block) + m_allocator_params.split_threshold) {
+    split_block = reinterpret_cast<Block *>(free_block->data + alloc_size);
+    split_block->data_size = free_block->data_size - alloc_size - sizeof(Block);
+    insert_block_to_free_list(split_block);
+    free_block->data_size = alloc_size;
+  }
+
+  // perform a non-comprehensive but cheap data reset, so that stale contents at the start of a reused block
+  // can't be mistaken for a client's header if the process crashes before the client writes one
+  if (alloc_size >= sizeof(uint64_t)) {
+    *reinterpret_cast<uint64_t *>(free_block->data) = 0;
+    mark_dirty(free_block->data, sizeof(uint64_t));
+  }
+  mark_block_dirty(free_block);
+
+  return split_block;
+}
+
+void FileBackedBuffer::release_block(Block * block)
+{
   remove_block_from_list(used_list(), block);
+  const FileByteOffset block_offset = to_offset(block);
+  const size_t block_size = sizeof(Block) + block->data_size;
   insert_block_to_free_list(block);
+
+  // the block may have been merged into the free block before it, which punch_holes() sorts out
+  if (m_allocator_params.punch_hole_min_size > 0 && block_size >= m_allocator_params.punch_hole_min_size
+      && m_can_punch.load(std::memory_order_relaxed)) {
+    bool wake_puncher;
+    {
+      std::unique_lock<std::mutex> punch_lock(m_punch_mutex);
+      m_pending_punches.emplace_back(block_offset, block_size);
+      m_pending_punch_size += block_size;
+      wake_puncher = m_pending_punch_size >= MAX_PENDING_PUNCH_SIZE;
+    }
+    if (wake_puncher) {
+      m_punch_requested.notify_one();
+    }
+  }
+}
+
+void FileBackedBuffer::punch_holes_in_background()
+{
+  std::unique_lock<std::mutex> punch_lock(m_punch_mutex);
+  while (!m_closing) {
+    m_punch_requested.wait_for(punch_lock, PUNCH_INTERVAL, [this]() {
+      return m_closing || m_pending_punch_size >= MAX_PENDING_PUNCH_SIZE;
+    });
+    if (!m_closing && !m_pending_punches.empty()) {
+      punch_lock.unlock();
+      punch_holes();
+      punch_lock.lock();
+    }
+  }
+}
+
+void FileBackedBuffer::pause_background_work()
+{
+  {
+    std::unique_lock<std::mutex> punch_lock(m_punch_mutex);
+    m_closing = true;
+  }
+  m_punch_requested.notify_one();
+  if (m_puncher.joinable()) {
+    m_puncher.join();
+  }
+  punch_holes();
+
+  std::unique_lock<std::mutex> residency_lock(m_residency_mutex);
+  stop_residency_manager(residency_lock);
+}
+
+void FileBackedBuffer::resume_background_work()
+{
+  {
+    std::unique_lock<std::mutex> punch_lock(m_punch_mutex);
+    m_closing = false;
+  }
+  if (!m_puncher.joinable()) {
+    m_puncher = std::thread(&FileBackedBuffer::punch_holes_in_background, this);
+  }
+
+  std::unique_lock<std::mutex> residency_lock(m_residency_mutex);
+  if (!m_residency_manager.joinable()
+      && (m_residency.warm_up == Residency::WarmUp::BACKGROUND || m_residency.cold_after.count() > 0)) {
+    m_residency_manager = std::thread(&FileBackedBuffer::manage_residency_in_background, this);
+  }
+}
+
+size_t FileBackedBuffer::punch_holes()
+{
+  std::vector<std::pair<FileByteOffset, size_t>> ranges;
+  {
+    std::unique_lock<std::mutex> punch_lock(m_punch_mutex);
+    ranges.swap(m_pending_punches);
+    m_pending_punch_size = 0;
+  }
+  if (ranges.empty()) {
+    return 0;
+  }
+  std::sort(ranges.begin(), ranges.end());
+
+  // a range may have been allocated from again since it was freed, so only the parts of it that lie inside the data of
+  // a block that is free now are punched. both are in file order, so one walk down the free list covers every range
+  // the holes are only found with m_mutex held, and then kept clear of allocations while they're punched without it
+  std::vector<std::pair<FileByteOffset, FileByteOffset>> holes;
+  std::unique_lock<std::mutex> write_lock(m_mutex);
+  FileByteOffset free_block_offset = free_list();
+  for (auto range = ranges.begin(); range != ranges.end(); ++range) {
+    const FileByteOffset range_end = range->first + range->second;
+    while (free_block_offset != NULL_OFFSET) {
+      const Block * free_block = reinterpret_cast<const Block *>(to_pointer(free_block_offset));
+      const FileByteOffset data_offset = to_offset(free_block->data);
+      const FileByteOffset data_end = data_offset + free_block->data_size;
+      if (data_offset >= range_end) {
+        break;
+      }
+      if (data_end > range->first) {
+        // whole pages only, anything else on the first and last page may still be in use
+        const FileByteOffset hole_offset = (std::max(data_offset, range->first) + m_page_size - 1) / m_page_size * m_page_size;
+        const FileByteOffset hole_end = std::min(data_end, range_end) / m_page_size * m_page_size;
+        if (hole_offset < hole_end) {
+          holes.emplace_back(hole_offset, hole_end);
+        }
+      }
+      if (data_end > range_end) {
+        break;  // the next range may start inside this block too
+      }
+      free_block_offset = free_block->next_block_offset;
+    }
+  }
+  m_punching_holes.insert(m_punching_holes.end(), holes.begin(), holes.end());
+  write_lock.unlock();
+
+  size_t num_punched_bytes = 0;
+  for (auto hole = holes.begin(); hole != holes.end() && m_can_punch.load(std::memory_order_relaxed); ++hole) {
+    if (fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, hole->first, hole->second - hole->first) != 0) {
+      int err = errno;
+      std::cerr << "[WARN] punching holes in the buffer file failed, no longer trying: " << strerror(err) << '\n';
+      m_can_punch.store(false, std::memory_order_relaxed);
+      break;
+    }
+    // the pages were only ever written with data that's gone now, a sync doesn't need to write them back but a
+    // copy has to pick up the zeros
+    for (size_t page = hole->first / m_page_size; page < hole->second / m_page_size; ++page) {
+      const uint64_t bit = uint64_t(1) << (page % 64);
+      m_dirty_pages[page / 64].fetch_and(~bit, std::memory_order_relaxed);
+      m_copy_dirty_pages[page / 64].fetch_or(bit, std::memory_order_release);
+    }
+    num_punched_bytes += hole->second - hole->first;
+    m_num_punched_holes.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  write_lock.lock();
+  for (const auto & hole : holes) {
+    m_punching_holes.erase(std::find(m_punching_holes.begin(), m_punching_holes.end(), hole));
+  }
+  write_lock.unlock();
+  m_holes_punched.notify_all();
+  m_num_punched_bytes.fetch_add(num_punched_bytes, std::memory_order_relaxed);
+  return num_punched_bytes;
 }
 
 void FileBackedBuffer::remove_block_from_list(FileByteOffset & list_head, Block * curr_block)
@@ -135,17 +486,21 @@ void FileBackedBuffer::remove_block_from_list(FileByteOffset & list_head, Block
   if (curr_block->prev_block_offset != NULL_OFFSET) {
     Block * prev_block = reinterpret_cast<Block *>(to_pointer(curr_block->prev_block_offset));
     prev_block->next_block_offset = curr_block->next_block_offset;
+    mark_block_dirty(prev_block);
   } else {
     list_head = curr_block->next_block_offset;
+    mark_dirty(m_header, sizeof(BufferHeader));
   }
 
   if (curr_block->next_block_offset != NULL_OFFSET) {
     Block * next_block = reinterpret_cast<Block *>(to_pointer(curr_block->next_block_offset));
     next_block->prev_block_offset = curr_block->prev_block_offset;
+    mark_block_dirty(next_block);
   }
 
   curr_block->prev_block_offset = NULL_OFFSET;
   curr_block->next_block_offset = NULL_OFFSET;
+  mark_block_dirty(curr_block);
 }
 
 // inserts block at the front of the list
@@ -154,12 +509,15 @@ void FileBackedBuffer::insert_block_to_used_list(Block * block)
   if (used_list() != NULL_OFFSET) {
     Block * next_block = reinterpret_cast<Block *>(to_pointer(used_list()));
     next_block->prev_block_offset = to_offset(block);
+    mark_block_dirty(next_block);
   }
 
   block->prev_block_offset = NULL_OFFSET;
   block->next_block_offset = used_list();
 
   used_list() = to_offset(block);
+  mark_block_dirty(block);
+  mark_dirty(m_header, sizeof(BufferHeader));
 }
 
 // inserts block in sorted order
@@ -169,7 +527,11 @@ void FileBackedBuffer::insert_block_to_free_list(Block * block)
 
   FileByteOffset curr_free_block_offset = free_list();
   if (curr_free_block_offset == NULL_OFFSET) {
+    block->prev_block_offset = NULL_OFFSET;
+    block->next_block_offset = NULL_OFFSET;
     free_list() = block_offset;
+    mark_block_dirty(block);
+    mark_dirty(m_header, sizeof(BufferHeader));
     return;
   }
 
@@ -210,14 +572,18 @@ void FileBackedBuffer::insert_block_to_free_list(Block * block)
 
   block->prev_block_offset = prev_free_block_offset;
   block->next_block_offset = next_free_block_offset;
+  mark_block_dirty(block);
   if (prev_block != nullptr) {
     prev_block->next_block_offset = block_offset;
+    mark_block_dirty(prev_block);
   } else {
     assert(curr_free_block_offset == free_list());
     free_list() = block_offset;
+    mark_dirty(m_header, sizeof(BufferHeader));
   }
   if (next_block != nullptr) {
     next_block->prev_block_offset = block_offset;
+    mark_block_dirty(next_block);
   }
 
   const bool prev_contiguous = prev_block != nullptr
@@ -228,15 +594,168 @@ void FileBackedBuffer::insert_block_to_free_list(Block * block)
     remove_block_from_list(free_list(), block);
     remove_block_from_list(free_list(), next_block);
     prev_block->data_size += (sizeof(Block) + block->data_size) + (sizeof(Block) + next_block->data_size);
+    mark_block_dirty(prev_block);
   } else if (prev_contiguous) {
     remove_block_from_list(free_list(), block);
     prev_block->data_size += (sizeof(Block) + block->data_size);
+    mark_block_dirty(prev_block);
   } else if (next_contiguous) {
     remove_block_from_list(free_list(), next_block);
     block->data_size += (sizeof(Block) + next_block->data_size);
+    mark_block_dirty(block);
   }
 }
 
+std::vector<uint8_t *> FileBackedBuffer::scan_used(const size_t num_threads) const
+{
+  std::unique_lock<std::mutex> write_lock(m_mutex);
+
+  // the free list is sorted by offset, which is what tells the free blocks apart. free blocks it no longer leads to
+  // are taken for used ones, which the client has to be able to tell apart from its allocations
+  std::vector<FileByteOffset> free_offsets;
+  FileByteOffset free_block_offset = m_header->next_free_block_offset;
+  while (free_block_offset != NULL_OFFSET) {
+    if (!block_in_bounds(free_block_offset) || (!free_offsets.empty() && free_block_offset <= free_offsets.back())) {
+      std::cerr << "[ERROR] free list links to an invalid block at offset " << free_block_offset << '\n';
+      break;
+    }
+    free_offsets.push_back(free_block_offset);
+    free_block_offset = reinterpret_cast<const Block *>(to_pointer(free_block_offset))->next_block_offset;
+  }
+
+  // each thread steps through its range from the first thing in it that looks like a block header, or the first free
+  // block if that comes sooner. its blocks are only kept from the one the range before it ended on, if it went through
+  // that one: from there on both follow the same headers. otherwise the range is stepped through again from there
+  const FileByteOffset end_offset = m_db_size & ~(ALIGNMENT - 1);
+  const size_t num_ranges = std::max<size_t>(1, std::min(num_threads, end_offset / MIN_SCAN_RANGE_SIZE));
+  std::vector<FileByteOffset> range_starts(num_ranges + 1);
+  for (size_t i = 0; i < num_ranges; ++i) {
+    range_starts[i] = sizeof(BufferHeader) + (end_offset - sizeof(BufferHeader)) * i / num_ranges / ALIGNMENT * ALIGNMENT;
+  }
+  range_starts[num_ranges] = end_offset;
+
+  madvise(m_base, m_db_size, MADV_SEQUENTIAL);
+  std::vector<std::vector<std::pair<FileByteOffset, uint8_t *>>> range_blocks(num_ranges);
+  std::vector<FileByteOffset> range_ends(num_ranges);
+  std::vector<uint8_t> ranges_intact(num_ranges);
+  auto walk_range = [this, &free_offsets, &range_starts, &range_blocks, &range_ends, &ranges_intact](const size_t i) -> void {
+    FileByteOffset block_offset = range_starts[i];
+    if (i > 0) {
+      const auto next_free = std::lower_bound(free_offsets.begin(), free_offsets.end(), block_offset);
+      const FileByteOffset search_end = next_free != free_offsets.end() ? std::min(range_starts[i + 1], *next_free) : range_starts[i + 1];
+      while (block_offset < search_end && !block_plausible(block_offset)) {
+        block_offset += ALIGNMENT;
+      }
+    }
+    ranges_intact[i] = walk_blocks(block_offset, range_starts[i + 1], free_offsets, range_blocks[i]);
+    range_ends[i] = block_offset;
+  };
+  std::vector<std::thread> threads; threads.reserve(num_ranges - 1);
+  for (size_t i = 1; i < num_ranges; ++i) {
+    threads.emplace_back(walk_range, i);
+  }
+  walk_range(0);
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+  madvise(m_base, m_db_size, MADV_NORMAL);
+
+  std::vector<uint8_t *> used_blocks;
+  FileByteOffset block_offset = sizeof(BufferHeader);
+  bool intact = true;
+  for (size_t i = 0; i < num_ranges && intact; ++i) {
+    std::vector<std::pair<FileByteOffset, uint8_t *>> & blocks = range_blocks[i];
+    auto first = std::lower_bound(blocks.begin(), blocks.end(), block_offset,
+                                  [](const std::pair<FileByteOffset, uint8_t *> & block, const FileByteOffset offset) { return block.first < offset; });
+    if (first != blocks.end() && first->first == block_offset) {
+      block_offset = range_ends[i];
+      intact = ranges_intact[i];
+    } else {
+      blocks.clear();
+      intact = walk_blocks(block_offset, range_starts[i + 1], free_offsets, blocks);
+      first = blocks.begin();
+    }
+    for (auto iter = first; iter != blocks.end(); ++iter) {
+      if (iter->second != nullptr) {
+        used_blocks.push_back(iter->second);
+      }
+    }
+  }
+  if (!intact) {
+    std::cerr << "[ERROR] block at offset " << block_offset << " runs past the end of the buffer, the blocks after it are skipped\n";
+  }
+
+  return used_blocks;
+}
+
+bool FileBackedBuffer::walk_blocks(FileByteOffset & block_offset, const FileByteOffset to, const std::vector<FileByteOffset> & free_offsets,
+                                   std::vector<std::pair<FileByteOffset, uint8_t *>> & blocks) const
+{
+  const FileByteOffset end_offset = m_db_size & ~(ALIGNMENT - 1);
+  auto next_free = std::lower_bound(free_offsets.begin(), free_offsets.end(), block_offset);
+  while (block_offset < to && block_offset + sizeof(Block) <= end_offset) {
+    if (!block_in_bounds(block_offset)) {
+      return false;
+    }
+    Block * block = reinterpret_cast<Block *>(to_pointer(block_offset));
+    while (next_free != free_offsets.end() && *next_free < block_offset) {
+      ++next_free;
+    }
+    const bool is_free = next_free != free_offsets.end() && *next_free == block_offset;
+    blocks.emplace_back(block_offset, is_free || block_offset == m_header->root_block_offset ? nullptr : block->data);
+    block_offset += sizeof(Block) + block->data_size;
+  }
+  return true;
+}
+
+std::vector<uint8_t *> FileBackedBuffer::list_used() const
+{
+  std::unique_lock<std::mutex> write_lock(m_mutex);
+
+  // every block links back to the one before it, which also rules out the list looping back on itself
+  std::vector<uint8_t *> used_blocks;
+  FileByteOffset prev_block_offset = NULL_OFFSET;
+  FileByteOffset block_offset = m_header->next_used_block_offset;
+  while (block_offset != NULL_OFFSET) {
+    const Block * block = reinterpret_cast<const Block *>(to_pointer(block_offset));
+    if (!block_in_bounds(block_offset) || block->prev_block_offset != prev_block_offset) {
+      std::cerr << "[ERROR] used list links to an invalid block at offset " << block_offset << ", the blocks after it are skipped\n";
+      break;
+    }
+    used_blocks.push_back(data_of(block_offset));
+    prev_block_offset = block_offset;
+    block_offset = block->next_block_offset;
+  }
+
+  return used_blocks;
+}
+
+// in bounds, and linked to nothing or to other blocks in bounds
+bool FileBackedBuffer::block_plausible(const FileByteOffset block_offset) const
+{
+  if (!block_in_bounds(block_offset)) {
+    return false;
+  }
+  const FileByteOffset end_offset = m_db_size & ~(ALIGNMENT - 1);
+  const Block * block = reinterpret_cast<const Block *>(to_pointer(block_offset));
+  for (const FileByteOffset link : {block->prev_block_offset, block->next_block_offset}) {
+    if (link != NULL_OFFSET && (link == block_offset || link % ALIGNMENT != 0 || link < sizeof(BufferHeader) || link + sizeof(Block) > end_offset)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool FileBackedBuffer::block_in_bounds(const FileByteOffset block_offset) const
+{
+  const FileByteOffset end_offset = m_db_size & ~(ALIGNMENT - 1);
+  if (block_offset % ALIGNMENT != 0 || block_offset < sizeof(BufferHeader) || block_offset + sizeof(Block) > end_offset) {
+    return false;
+  }
+  const Block * block = reinterpret_cast<const Block *>(to_pointer(block_offset));
+  return block->data_size % ALIGNMENT == 0 && block->data_size <= end_offset - block_offset - sizeof(Block);
+}
+
 std::pair<uint8_t *, size_t> FileBackedBuffer::const_iterator::operator*()
 {
   if (m_offset == NULL_OFFSET) {
@@ -264,6 +783,562 @@ FileBackedBuffer::const_iterator FileBackedBuffer::const_iterator::operator--()
   return *this;
 }
 
+void FileBackedBuffer::mark_dirty(const void * pointer, const size_t size)
+{
+  const size_t first_page = to_offset(pointer) / m_page_size;
+  const size_t last_page = (to_offset(pointer) + size - 1) / m_page_size;
+  for (size_t page = first_page; page <= last_page; ++page) {
+    const uint64_t bit = uint64_t(1) << (page % 64);
+    // most marks hit a page that is already dirty, which a read can tell without taking the cache line
+    for (std::vector<std::atomic<uint64_t>> * bitmap : {&m_dirty_pages, &m_copy_dirty_pages}) {
+      std::atomic<uint64_t> & word = (*bitmap)[page / 64];
+      if ((word.load(std::memory_order_relaxed) & bit) == 0) {
+        word.fetch_or(bit, std::memory_order_release);
+      }
+    }
+  }
+}
+
+void FileBackedBuffer::take_dirty_runs(std::vector<std::atomic<uint64_t>> & bitmap,
+                                       const std::function<void(const size_t first_page, const size_t num_pages)> & handle_run)
+{
+  size_t run_start = 0;
+  size_t run_length = 0;
+  auto end_run = [&]() -> void {
+    if (run_length > 0) {
+      handle_run(run_start, run_length);
+      run_length = 0;
+    }
+  };
+
+  for (size_t i = 0; i < bitmap.size(); ++i) {
+    // taken off the bitmap before being handled, a page written to meanwhile is marked again
+    const uint64_t word = (bitmap[i].load(std::memory_order_relaxed) == 0) ? 0 : bitmap[i].exchange(0, std::memory_order_acquire);
+    if (word == 0) {
+      end_run();
+      continue;
+    }
+    for (size_t bit = 0; bit < 64; ++bit) {
+      const size_t page = i * 64 + bit;
+      if ((word & (uint64_t(1) << bit)) == 0) {
+        end_run();
+      } else if (run_length++ == 0) {
+        run_start = page;
+      }
+    }
+  }
+  end_run();
+}
+
+void FileBackedBuffer::set_residency(const Residency & residency)
+{
+  std::unique_lock<std::mutex> residency_lock(m_residency_mutex);
+  stop_residency_manager(residency_lock);
+  m_residency = residency;
+  m_prefetch_large_reads.store(residency.prefetch_large_reads, std::memory_order_relaxed);
+  m_track_reads.store(residency.cold_after.count() > 0, std::memory_order_relaxed);
+
+  for (const std::pair<void *, size_t> & range : m_locked_ranges) {
+    munlock(range.first, range.second);
+  }
+  m_locked_ranges.clear();
+  if (residency.lock_metadata) {
+    // whole pages, the root block is small
+    const uintptr_t page_mask = ~static_cast<uintptr_t>(m_page_size - 1);
+    m_locked_ranges.emplace_back(m_base, sizeof(BufferHeader));
+    if (root() != nullptr) {
+      const uintptr_t root_start = reinterpret_cast<uintptr_t>(root() - sizeof(Block)) & page_mask;
+      const uintptr_t root_end = reinterpret_cast<uintptr_t>(root() + size_of(root()));
+      m_locked_ranges.emplace_back(reinterpret_cast<void *>(root_start), root_end - root_start);
+    }
+    for (auto range = m_locked_ranges.begin(); range != m_locked_ranges.end();) {
+      if (mlock(range->first, range->second) != 0) {
+        int err = errno;
+        std::cerr << "[WARN] locking the buffer's metadata in memory failed: " << strerror(err) << '\n';
+        range = m_locked_ranges.erase(range);
+      } else {
+        ++range;
+      }
+    }
+  }
+
+  if (residency.warm_up == Residency::WarmUp::POPULATE) {
+    const auto start_time = std::chrono::steady_clock::now();
+    const size_t num_bytes = warm_up([]() { return false; });
+    const std::chrono::duration<double, std::milli> warm_up_time = std::chrono::steady_clock::now() - start_time;
+    std::cout << "[INFO] faulted in " << num_bytes << " bytes of used blocks in " << warm_up_time.count() << " ms\n";
+  }
+  if (residency.warm_up == Residency::WarmUp::BACKGROUND || residency.cold_after.count() > 0) {
+    m_residency_manager = std::thread(&FileBackedBuffer::manage_residency_in_background, this);
+  }
+}
+
+void FileBackedBuffer::stop_residency_manager(std::unique_lock<std::mutex> & residency_lock)
+{
+  if (m_residency_manager.joinable()) {
+    m_stop_residency = true;
+    residency_lock.unlock();
+    m_residency_changed.notify_one();
+    m_residency_manager.join();
+    residency_lock.lock();
+    m_stop_residency = false;
+  }
+}
+
+void FileBackedBuffer::prepare_read(const void * pointer, const size_t size) const
+{
+  if (m_track_reads.load(std::memory_order_relaxed)) {
+    for (size_t region = to_offset(pointer) / RESIDENCY_REGION_SIZE; region <= (to_offset(pointer) + size - 1) / RESIDENCY_REGION_SIZE; ++region) {
+      // as with mark_dirty(), a region read from recently is most likely marked already
+      std::atomic<uint64_t> & word = m_read_regions[region / 64];
+      const uint64_t bit = uint64_t(1) << (region % 64);
+      if ((word.load(std::memory_order_relaxed) & bit) == 0) {
+        word.fetch_or(bit, std::memory_order_relaxed);
+      }
+    }
+  }
+  if (size >= PREFETCH_MIN_SIZE && m_prefetch_large_reads.load(std::memory_order_relaxed)) {
+    // one read ahead of the whole range, rather than a fault per page as the copy reaches it
+    const uintptr_t start = reinterpret_cast<uintptr_t>(pointer) & ~static_cast<uintptr_t>(m_page_size - 1);
+    madvise(reinterpret_cast<void *>(start), reinterpret_cast<uintptr_t>(pointer) + size - start, MADV_WILLNEED);
+  }
+}
+
+void FileBackedBuffer::manage_residency_in_background()
+{
+  std::unique_lock<std::mutex> residency_lock(m_residency_mutex);
+  if (m_residency.warm_up == Residency::WarmUp::BACKGROUND) {
+    residency_lock.unlock();
+    const auto start_time = std::chrono::steady_clock::now();
+    const size_t num_bytes = warm_up([this]() {
+      std::unique_lock<std::mutex> residency_lock(m_residency_mutex);
+      return m_stop_residency;
+    });
+    const std::chrono::duration<double, std::milli> warm_up_time = std::chrono::steady_clock::now() - start_time;
+    std::cout << "[INFO] faulted in " << num_bytes << " bytes of used blocks in the background in " << warm_up_time.count() << " ms\n";
+    residency_lock.lock();
+  }
+
+  while (!m_stop_residency) {
+    if (m_residency.cold_after.count() == 0) {
+      m_residency_changed.wait(residency_lock, [this]() { return m_stop_residency; });
+    } else if (!m_residency_changed.wait_for(residency_lock, m_residency.cold_after, [this]() { return m_stop_residency; })) {
+      residency_lock.unlock();
+      deactivate_unread_regions();
+      residency_lock.lock();
+    }
+  }
+}
+
+size_t FileBackedBuffer::warm_up(const std::function<bool()> & stop)
+{
+  // neighbouring blocks are faulted in together, a page-aligned run at a time
+  std::vector<uint8_t *> used_blocks = scan_used();
+  size_t num_bytes = 0;
+  size_t run_start = 0;
+  size_t run_end = 0;
+  auto fault_in_run = [this, &num_bytes, &run_start, &run_end]() -> void {
+    if (run_end > run_start) {
+      if (madvise(m_base + run_start, run_end - run_start, MADV_POPULATE_READ) != 0) {
+        // older kernels, it's read ahead at least
+        madvise(m_base + run_start, run_end - run_start, MADV_WILLNEED);
+      }
+      num_bytes += run_end - run_start;
+    }
+  };
+  for (uint8_t * data : used_blocks) {
+    if (stop()) {
+      break;
+    }
+    const size_t block_start = to_offset(data - sizeof(Block)) / m_page_size * m_page_size;
+    const size_t block_end = std::min((to_offset(data) + size_of(data) + m_page_size - 1) / m_page_size * m_page_size,
+                                      m_db_size);
+    if (block_start > run_end) {
+      fault_in_run();
+      run_start = block_start;
+    }
+    run_end = std::max(run_end, block_end);
+  }
+  fault_in_run();
+  m_num_warmed_bytes.fetch_add(num_bytes, std::memory_order_relaxed);
+  return num_bytes;
+}
+
+void FileBackedBuffer::deactivate_unread_regions()
+{
+  for (size_t i = 0; i < m_read_regions.size(); ++i) {
+    // taken off the bitmap before being looked at, a region read from meanwhile is marked again
+    const uint64_t word = m_read_regions[i].exchange(0, std::memory_order_relaxed);
+    for (size_t region = i * 64; region < std::min((i + 1) * 64, m_cold_regions.size()); ++region) {
+      if ((word & (uint64_t(1) << (region % 64))) != 0) {
+        m_cold_regions[region] = false;
+      } else if (!m_cold_regions[region]) {
+        const size_t region_size = std::min(RESIDENCY_REGION_SIZE, m_db_size - region * RESIDENCY_REGION_SIZE);
+        madvise(m_base + region * RESIDENCY_REGION_SIZE, region_size, MADV_COLD);
+        m_cold_regions[region] = true;
+        m_num_deactivated_regions.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+size_t FileBackedBuffer::num_dirty_pages() const
+{
+  size_t num_dirty = 0;
+  for (const std::atomic<uint64_t> & word : m_dirty_pages) {
+    num_dirty += __builtin_popcountll(word.load(std::memory_order_relaxed));
+  }
+  return num_dirty;
+}
+
+bool FileBackedBuffer::sync()
+{
+  std::unique_lock<std::mutex> sync_lock(m_sync_mutex);
+  if (m_volatile) {
+    take_dirty_runs(m_dirty_pages, [](const size_t, const size_t) -> void {});
+    return true;
+  }
+  // each run of consecutive dirty pages is written back with one msync()
+  bool success = true;
+  take_dirty_runs(m_dirty_pages, [this, &success](const size_t first_page, const size_t num_pages) -> void {
+    const size_t run_end = std::min((first_page + num_pages) * m_page_size, m_db_size);
+    if (msync(m_base + first_page * m_page_size, run_end - first_page * m_page_size, MS_SYNC) != 0) {
+      int err = errno;
+      std::cerr << "[ERROR] " << strerror(err) << '\n';
+      success = false;
+    }
+    m_num_synced_pages.fetch_add(num_pages, std::memory_order_relaxed);
+  });
+
+  return success;
+}
+
+// the copy is taken the way a running virtual machine is migrated. the whole file is copied while it's being written
+// to, then the pages written to meanwhile are copied again, and again, until there are few enough left to copy with
+// writers paused, at which point the copy matches the buffer as of a single moment
+bool FileBackedBuffer::copy_to(const char * filename, const std::function<std::unique_lock<std::mutex>()> & pause_writers)
+{
+  std::unique_lock<std::mutex> copy_lock(m_copy_mutex);
+
+  const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+  if (fd < 0) {
+    int err = errno;
+    std::cerr << "[ERROR] opening " << filename << " failed: " << strerror(err) << '\n';
+    return false;
+  }
+  bool success = copy_whole(fd, pause_writers);
+  if (!success || fdatasync(fd) != 0) {
+    int err = errno;
+    std::cerr << "[ERROR] copying buffer to " << filename << " failed: " << strerror(err) << '\n';
+    success = false;
+  }
+  close(fd);
+
+  if (success) {
+    ++m_copy_sequence;
+  }
+  return success;
+}
+
+bool FileBackedBuffer::copy_whole(const int fd, const std::function<std::unique_lock<std::mutex>()> & pause_writers)
+{
+  if (ftruncate(fd, m_db_size) != 0) {
+    return false;
+  }
+
+  // from here on, pages written to are marked for copying again
+  take_dirty_runs(m_copy_dirty_pages, [](const size_t, const size_t) -> void {});
+  const size_t num_pages = (m_db_size + m_page_size - 1) / m_page_size;
+  if (!copy_pages(fd, 0, num_pages, true)) {
+    return false;
+  }
+  return copy_written_pages([this, fd](const size_t first_page, const size_t num_pages) -> bool {
+    return copy_pages(fd, first_page, num_pages, false);
+  }, pause_writers);
+}
+
+bool FileBackedBuffer::copy_written_pages(const std::function<bool(const size_t first_page, const size_t num_pages)> & copy_run,
+                                          const std::function<std::unique_lock<std::mutex>()> & pause_writers)
+{
+  bool success = true;
+  auto copy_runs = [&copy_run, &success](const size_t first_page, const size_t num_pages) -> void {
+    success = success && copy_run(first_page, num_pages);
+  };
+  size_t num_passes = 0;
+  while (success && num_passes < MAX_COPY_PASSES && num_pages_to_copy() > MAX_PAUSED_COPY_PAGES) {
+    take_dirty_runs(m_copy_dirty_pages, copy_runs);
+    ++num_passes;
+  }
+  if (!success) {
+    return false;
+  }
+
+  const auto pause_start_time = std::chrono::steady_clock::now();
+  {
+    std::unique_lock<std::mutex> writers_lock = pause_writers();
+    std::unique_lock<std::mutex> write_lock(m_mutex);
+    take_dirty_runs(m_copy_dirty_pages, copy_runs);
+  }
+  const uint64_t pause_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pause_start_time).count();
+  if (pause_time > m_longest_copy_pause.load(std::memory_order_relaxed)) {
+    m_longest_copy_pause.store(pause_time, std::memory_order_relaxed);
+  }
+  return success;
+}
+
+// a backup directory holds a whole copy of the buffer file and the deltas taken after it, in the order listed by its
+// MANIFEST. a delta is a DeltaHeader followed by runs of pages, each a DeltaRun followed by the bytes of the run. runs
+// are applied in order, a page copied again during the same backup appears again, later
+constexpr uint64_t DELTA_MAGIC = 0x313030746c64766b;  // "kvdlt001"
+constexpr char MANIFEST_FILENAME[] = "MANIFEST";
+constexpr char BASE_FILENAME[] = "base.bin";
+
+struct DeltaHeader {
+  uint64_t magic;
+  uint64_t file_size;  // of the buffer file
+};
+
+struct DeltaRun {
+  uint64_t offset;
+  uint64_t length;  // bytes
+};
+
+static bool write_all(const int fd, const void * data, const size_t size)
+{
+  size_t written = 0;
+  while (written < size) {
+    const ssize_t result = write(fd, static_cast<const uint8_t *>(data) + written, size - written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += result;
+  }
+  return true;
+}
+
+static bool read_all(const int fd, void * data, const size_t size)
+{
+  size_t num_read = 0;
+  while (num_read < size) {
+    const ssize_t result = read(fd, static_cast<uint8_t *>(data) + num_read, size - num_read);
+    if (result <= 0) {
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    num_read += result;
+  }
+  return true;
+}
+
+// the first line identifies the buffer the backups were taken from, and how many copies it had made by the last one
+static bool read_manifest(const std::string & directory, uint64_t & session, uint64_t & sequence, std::vector<std::string> & chain)
+{
+  std::ifstream manifest(directory + "/" + MANIFEST_FILENAME);
+  if (!manifest || !(manifest >> std::hex >> session >> std::dec >> sequence)) {
+    return false;
+  }
+  std::string filename;
+  while (manifest >> filename) {
+    chain.push_back(filename);
+  }
+  return !chain.empty() && chain.front() == BASE_FILENAME;
+}
+
+// replaced as a whole, so that a backup that fails part way leaves the chain as it was
+static bool write_manifest(const std::string & directory, const uint64_t session, const uint64_t sequence, const std::vector<std::string> & chain)
+{
+  std::string contents;
+  {
+    std::ostringstream manifest;
+    manifest << std::hex << session << ' ' << std::dec << sequence << '\n';
+    for (const std::string & filename : chain) {
+      manifest << filename << '\n';
+    }
+    contents = manifest.str();
+  }
+
+  const std::string path = directory + "/" + MANIFEST_FILENAME;
+  const std::string temporary_path = path + ".tmp";
+  const int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+  if (fd < 0) {
+    return false;
+  }
+  const bool success = write_all(fd, contents.data(), contents.size()) && fdatasync(fd) == 0;
+  close(fd);
+  return success && rename(temporary_path.c_str(), path.c_str()) == 0;
+}
+
+bool FileBackedBuffer::backup_to(const char * directory, const std::function<std::unique_lock<std::mutex>()> & pause_writers)
+{
+  std::unique_lock<std::mutex> copy_lock(m_copy_mutex);
+
+  if (mkdir(directory, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 && errno != EEXIST) {
+    int err = errno;
+    std::cerr << "[ERROR] creating " << directory << " failed: " << strerror(err) << '\n';
+    return false;
+  }
+
+  // a delta only follows on from the last copy this buffer made, otherwise the chain starts over
+  uint64_t session = 0;
+  uint64_t sequence = 0;
+  std::vector<std::string> chain;
+  const bool incremental = read_manifest(directory, session, sequence, chain)
+                           && session == m_copy_session && sequence == m_copy_sequence;
+  if (!incremental) {
+    chain.clear();
+  }
+  std::string filename = BASE_FILENAME;
+  if (incremental) {
+    std::ostringstream delta_filename;
+    delta_filename << "delta-" << std::setw(6) << std::setfill('0') << chain.size() << ".bin";
+    filename = delta_filename.str();
+  }
+
+  const std::string path = std::string(directory) + "/" + filename;
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+  if (fd < 0) {
+    int err = errno;
+    std::cerr << "[ERROR] opening " << path << " failed: " << strerror(err) << '\n';
+    return false;
+  }
+  bool success;
+  if (incremental) {
+    const DeltaHeader header = {DELTA_MAGIC, m_db_size};
+    success = write_all(fd, &header, sizeof(header))
+              && copy_written_pages([this, fd](const size_t first_page, const size_t num_pages) -> bool {
+                   const size_t offset = first_page * m_page_size;
+                   const DeltaRun run = {offset, std::min(num_pages * m_page_size, m_db_size - offset)};
+                   m_num_copied_pages.fetch_add(num_pages, std::memory_order_relaxed);
+                   return write_all(fd, &run, sizeof(run)) && write_all(fd, m_base + run.offset, run.length);
+                 }, pause_writers);
+  } else {
+    success = copy_whole(fd, pause_writers);
+  }
+  success = success && fdatasync(fd) == 0;
+  close(fd);
+
+  if (success) {
+    ++m_copy_sequence;
+    chain.push_back(filename);
+    success = write_manifest(directory, m_copy_session, m_copy_sequence, chain);
+  }
+  if (!success) {
+    int err = errno;
+    std::cerr << "[ERROR] backing up buffer to " << path << " failed: " << strerror(err) << '\n';
+  }
+  return success;
+}
+
+bool FileBackedBuffer::restore_backup(const char * directory, const char * filename)
+{
+  uint64_t session;
+  uint64_t sequence;
+  std::vector<std::string> chain;
+  if (!read_manifest(directory, session, sequence, chain)) {
+    std::cerr << "[ERROR] " << directory << " has no backup to restore\n";
+    return false;
+  }
+
+  const int fd = open(filename, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+  if (fd < 0) {
+    int err = errno;
+    std::cerr << "[ERROR] creating " << filename << " failed: " << strerror(err) << '\n';
+    return false;
+  }
+
+  bool success = true;
+  std::vector<uint8_t> data;
+  for (size_t i = 0; i < chain.size() && success; ++i) {
+    const std::string path = std::string(directory) + "/" + chain[i];
+    const int backup_fd = open(path.c_str(), O_RDONLY);
+    if (backup_fd < 0) {
+      std::cerr << "[ERROR] opening " << path << " failed\n";
+      success = false;
+      break;
+    }
+
+    if (i == 0) {
+      // the whole copy, as is
+      uint8_t buffer[65536];
+      ssize_t result;
+      while ((result = read(backup_fd, buffer, sizeof(buffer))) > 0 && success) {
+        success = write_all(fd, buffer, result);
+      }
+      success = success && result == 0;
+    } else {
+      DeltaHeader header;
+      success = read_all(backup_fd, &header, sizeof(header)) && header.magic == DELTA_MAGIC;
+      DeltaRun run;
+      while (success && read_all(backup_fd, &run, sizeof(run))) {
+        data.resize(run.length);
+        success = run.offset + run.length <= header.file_size
+                  && read_all(backup_fd, data.data(), run.length)
+                  && pwrite(fd, data.data(), run.length, run.offset) == static_cast<ssize_t>(run.length);
+      }
+    }
+    close(backup_fd);
+    if (!success) {
+      std::cerr << "[ERROR] " << path << " is damaged\n";
+    }
+  }
+
+  success = success && fdatasync(fd) == 0;
+  close(fd);
+  if (success) {
+    std::cout << "[INFO] restored " << filename << " from " << chain.size() << " backups in " << directory << '\n';
+  } else {
+    unlink(filename);
+  }
+  return success;
+}
+
+size_t FileBackedBuffer::num_pages_to_copy() const
+{
+  size_t num_pages = 0;
+  for (const std::atomic<uint64_t> & word : m_copy_dirty_pages) {
+    num_pages += __builtin_popcountll(word.load(std::memory_order_relaxed));
+  }
+  return num_pages;
+}
+
+// in_kernel copies with copy_file_range(), which can share the blocks of the file instead of copying them on
+// filesystems that support it, but has to write back dirty pages first. short runs of pages are copied from the
+// mapping instead
+bool FileBackedBuffer::copy_pages(const int fd, const size_t first_page, const size_t num_pages, const bool in_kernel)
+{
+  size_t offset = first_page * m_page_size;
+  const size_t end = std::min((first_page + num_pages) * m_page_size, m_db_size);
+  while (in_kernel && offset < end) {
+    loff_t in_offset = offset;
+    loff_t out_offset = offset;
+    const ssize_t result = copy_file_range(m_fd, &in_offset, fd, &out_offset, end - offset, 0);
+    if (result <= 0) {
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      break;  // not supported between these files, copy the rest from the mapping
+    }
+    offset += result;
+  }
+  while (offset < end) {
+    const ssize_t result = pwrite(fd, m_base + offset, end - offset, offset);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    offset += result;
+  }
+  m_num_copied_pages.fetch_add(num_pages, std::memory_order_relaxed);
+  return true;
+}
+
 void FileBackedBuffer::print_stats() const
 {
   // calculate stats for used blocks
@@ -322,5 +1397,16 @@ void FileBackedBuffer::print_stats() const
             << "    total free block size (bytes): " << total_free_block_size << '\n'
             << "    average free block size (bytes): " << average_free_block_size << '\n'
             << "  free space fragmentation: " << fragmentation << '\n'
+            << "  dirty pages: " << num_dirty_pages() << '\n'
+            << "  pages synced: " << m_num_synced_pages.load(std::memory_order_relaxed) << '\n'
+            << "  pages copied by copy_to(): " << m_num_copied_pages.load(std::memory_order_relaxed) << '\n'
+            << "  longest copy_to() pause (us): " << m_longest_copy_pause.load(std::memory_order_relaxed) << '\n'
+            << "  holes punched: " << m_num_punched_holes.load(std::memory_order_relaxed) << " ("
+            << m_num_punched_bytes.load(std::memory_order_relaxed) << " bytes)\n"
+            << "  bytes warmed up: " << m_num_warmed_bytes.load(std::memory_order_relaxed) << '\n'
+            << "  regions deactivated: " << m_num_deactivated_regions.load(std::memory_order_relaxed) << '\n'
+            << "  backing: " << (m_volatile ? "memory" : "file") << '\n'
+            << "  pages: " << (m_pages == Pages::HUGETLBFS ? "hugetlbfs" : m_pages == Pages::TRANSPARENT_HUGE ? "transparent huge" : "normal")
+            << " (" << m_page_size << " bytes)\n"
             << '\n';
 }
@@ -4,7 +4,14 @@
 #include <cstddef>
 #include <cstdint>
 #include <utility>
+#include <vector>
+#include <atomic>
 #include <mutex>
+#include <functional>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
 
 
 using FileByteOffset = size_t;
@@ -15,13 +22,60 @@ constexpr FileByteOffset NULL_OFFSET = 0;
 class FileBackedBuffer
 {
 public:
-  FileBackedBuffer(const char * filename, const size_t buffer_size);
+  // what the mapping is backed by. TRANSPARENT_HUGE aligns the mapping to a huge page and asks for it to be mapped with
+  // huge pages (MADV_HUGEPAGE), which the kernel does where the file system caches the file in large enough folios.
+  // a buffer file on a hugetlbfs mount is always HUGETLBFS, with its size rounded up to a whole huge page. it keeps
+  // the store in memory only, as long as the file is there (until a reboot)
+  enum class Pages {
+    NORMAL,
+    TRANSPARENT_HUGE,
+    HUGETLBFS
+  };
+
+  // fd, if given, is an already open descriptor of the buffer file to use instead of opening filename, e.g. one that
+  // was handed over from another process. the buffer takes ownership of it
+  // with no filename (nullptr), the buffer is volatile, kept in anonymous memory (a memfd) rather than in a file, and
+  // sync() has nothing to do. it can still be copied, backed up and handed over
+  FileBackedBuffer(const char * filename,
+                   const size_t buffer_size,
+                   const int fd = -1,
+                   const Pages pages = Pages::NORMAL);
   ~FileBackedBuffer();
 
   // TODO: look into replacing this naive allocator implementation with open source jemalloc algorithm or something similar
   uint8_t * alloc(const size_t alloc_size);
   void free(const uint8_t * pointer);
 
+  // offsets are stable across remapping, so they are what to store inside the buffer to refer to other allocations
+  FileByteOffset offset_of(const uint8_t * pointer) const { return to_offset(pointer); }
+  uint8_t * pointer_at(const FileByteOffset offset) const { return static_cast<uint8_t *>(to_pointer(offset)); }
+  // whether offset, read back from the file, can be followed to an allocation: its block is aligned and within the file
+  bool allocation_in_bounds(const FileByteOffset offset) const { return offset >= sizeof(Block) && block_in_bounds(offset - sizeof(Block)); }
+  // size of the allocation at pointer, which can be more than was asked for
+  size_t size_of(const uint8_t * pointer) const { return reinterpret_cast<const Block *>(pointer - sizeof(Block))->data_size; }
+
+  // the root block is a single allocation for the client's own metadata, found again through the buffer header
+  // when the buffer file is reopened. it is not on the used list
+  uint8_t * root() const { return m_header->root_block_offset == NULL_OFFSET ? nullptr : data_of(m_header->root_block_offset); }
+  uint8_t * alloc_root(const size_t alloc_size);
+
+  // size of a buffer that fits a root block of root_size bytes and nothing else
+  static size_t size_for_root(const size_t root_size);
+
+  // allocates a block for each of alloc_sizes while holding the lock once
+  // the blocks are carved back-to-back out of a single free block when one is big enough, otherwise each is allocated
+  // individually. failed allocations are returned as nullptr, or if all_or_nothing is set then either every
+  // allocation succeeds or none are made (and all results are nullptr)
+  std::vector<uint8_t *> alloc_batch(const std::vector<size_t> & alloc_sizes, const bool all_or_nothing);
+
+  // the used blocks in the order they are laid out in the file, found by stepping from block header to block header
+  // front to back with the kernel reading ahead, rather than following the used list around the file. the file is split
+  // into ranges that up to num_threads threads step through at once
+  std::vector<uint8_t *> scan_used(const size_t num_threads = 1) const;
+  // the used blocks in the order of the used list. both stop with an error at a block header that points outside the
+  // buffer, or that doesn't fit with the blocks around it
+  std::vector<uint8_t *> list_used() const;
+
   class const_iterator
   {
   public:
@@ -46,11 +100,74 @@ public:
   const_iterator begin_free() const { return const_iterator(this, m_header->next_free_block_offset); }
   const_iterator end_free() const { return const_iterator(this, NULL_OFFSET); }
 
+  // the buffer tracks which pages were written since the last sync(), so that a sync writes back only those
+  // the allocator marks what it writes itself, clients mark the parts of their allocations they write, after writing
+  void mark_dirty(const void * pointer, const size_t size);
+  size_t num_dirty_pages() const;
+
+  // writes the dirty pages back to the file, returns once they're on disk
+  // pages dirtied while a sync is in progress are left for the next one
+  bool sync();
+
+  // writes a copy of the buffer file to filename, as it was at a single moment, while the buffer stays in use.
+  // pause_writers() must return a lock that keeps the client from writing to its allocations, it's held only for
+  // the last few pages to be copied. allocations and frees are paused along with it
+  bool copy_to(const char * filename, const std::function<std::unique_lock<std::mutex>()> & pause_writers);
+
+  // backs the buffer up to directory the same way as copy_to(), but after the first backup only copies the pages
+  // written since the last one, as a delta on top of it. the chain starts over with a whole copy if the last backup in
+  // directory isn't the last copy this buffer made (another copy_to() in between, or a restart)
+  bool backup_to(const char * directory, const std::function<std::unique_lock<std::mutex>()> & pause_writers);
+  // rebuilds the buffer file as of the last backup in directory, as a new file
+  static bool restore_backup(const char * directory, const char * filename);
+
+  // what the buffer does to keep the parts of the file that are in use in memory, and to let go of the rest
+  struct Residency {
+    enum class WarmUp {
+      NONE,
+      POPULATE,   // set_residency() faults in the used blocks before it returns
+      BACKGROUND  // a background thread faults in the used blocks
+    };
+    WarmUp warm_up = WarmUp::NONE;
+    bool prefetch_large_reads = false;  // prepare_read() starts reading ahead reads of PREFETCH_MIN_SIZE bytes or more
+    std::chrono::minutes cold_after{0};  // regions not read from for this long are deactivated (MADV_COLD), 0 for never
+    bool lock_metadata = false;  // the buffer header and the root block are locked in memory (mlock())
+  };
+  // the warm-up covers the used blocks only, rather than the whole file the way MAP_POPULATE would, since most of a
+  // new file is still a hole
+  void set_residency(const Residency & residency);
+  // for clients to call before reading size bytes at pointer. counts as a read from that part of the buffer
+  void prepare_read(const void * pointer, const size_t size) const;
+
+  // how the allocator carves up the file. set it before the first allocation
+  struct AllocatorParams {
+    size_t split_threshold = 100;  // bytes, a free block is only split if at least this much data would be left over
+    size_t punch_hole_min_size = 262144;  // bytes, see punch_holes(). 0 never punches holes
+  };
+  void set_allocator_params(const AllocatorParams & params);
+
+  // the page-aligned interior of a freed block of at least punch_hole_min_size bytes is punched out of the file in the
+  // background, batched every PUNCH_INTERVAL, so that disk space and page cache follow the live data. a hole reads as
+  // zeros. punch_holes() punches the holes queued so far right away, returns the number of bytes punched
+  size_t punch_holes();
+
+  // stops the background threads, before the file is handed to another process, which is free to reuse any range a
+  // queued hole would be punched in. the holes queued so far are punched first. resume_background_work() restarts them
+  void pause_background_work();
+  void resume_background_work();
+
+  int fd() const { return m_fd; }
+  Pages pages() const { return m_pages; }
+  bool is_volatile() const { return m_volatile; }
+  size_t page_size() const { return m_page_size; }  // the unit of dirty tracking, syncs, copies and holes
+
   void print_stats() const;
   bool dump_usage(const std::string & filename) const;
 
 private:
   struct BufferHeader {
+    uint64_t magic;
+    FileByteOffset root_block_offset;
     FileByteOffset next_free_block_offset;
     FileByteOffset next_used_block_offset;
   };
@@ -64,21 +181,105 @@ private:
     uint8_t data[];
   };
 
+  bool on_hugetlbfs(const int fd);  // and sets m_page_size if it is
+
   void * to_pointer(const FileByteOffset offset) const { return m_base + offset; }
+  uint8_t * data_of(const FileByteOffset block_offset) const { return reinterpret_cast<Block *>(to_pointer(block_offset))->data; }
   FileByteOffset to_offset(const void * pointer) const { return static_cast<const uint8_t *>(pointer) - m_base; }
 
   FileByteOffset & free_list() { return m_header->next_free_block_offset; }
+  bool block_in_bounds(const FileByteOffset block_offset) const;  // whether a block header there can be followed
+  bool block_plausible(const FileByteOffset block_offset) const;  // whether a block header could be there at all
+  // steps from the block at block_offset up to the first one at or past to, adding each to blocks with its data, or
+  // nullptr for free blocks and the root. false if it stops at a block header that doesn't fit, left in block_offset
+  bool walk_blocks(FileByteOffset & block_offset, const FileByteOffset to, const std::vector<FileByteOffset> & free_offsets,
+                   std::vector<std::pair<FileByteOffset, uint8_t *>> & blocks) const;
   FileByteOffset & used_list() { return m_header->next_used_block_offset; }
 
+  // first fit, among the blocks that the allocation wouldn't carve into a hole being punched. waits for the punch to
+  // finish rather than fail, if those are the only ones that fit
+  Block * find_free_block(const size_t min_size, std::unique_lock<std::mutex> & write_lock);
+  Block * carve_block(Block * free_block, const size_t alloc_size);  // returns the split off remainder, if any
+  void release_block(Block * block);
+
   void remove_block_from_list(FileByteOffset & list_head, Block * block);
   void insert_block_to_used_list(Block * block);
   void insert_block_to_free_list(Block * block);  // will perform sorted insert and merges
+  void mark_block_dirty(const Block * block) { mark_dirty(block, sizeof(Block)); }
+
+  // calls handle_run for each run of consecutive pages marked in bitmap, taking them off it
+  void take_dirty_runs(std::vector<std::atomic<uint64_t>> & bitmap,
+                       const std::function<void(const size_t first_page, const size_t num_pages)> & handle_run);
+  bool copy_whole(const int fd, const std::function<std::unique_lock<std::mutex>()> & pause_writers);
+  // copies the pages written since they were last copied, in passes and then with writers paused
+  bool copy_written_pages(const std::function<bool(const size_t first_page, const size_t num_pages)> & copy_run,
+                          const std::function<std::unique_lock<std::mutex>()> & pause_writers);
+  size_t num_pages_to_copy() const;
+  bool copy_pages(const int fd, const size_t first_page, const size_t num_pages, const bool in_kernel);
+  void punch_holes_in_background();
+  void manage_residency_in_background();
+  void stop_residency_manager(std::unique_lock<std::mutex> & residency_lock);
+  size_t warm_up(const std::function<bool()> & stop);  // returns the number of bytes faulted in
+  void deactivate_unread_regions();
+
+  // copy_to() stops going over the pages written during the copy after this many passes, or once this few are left
+  static constexpr size_t MAX_COPY_PASSES = 8;
+  static constexpr size_t MAX_PAUSED_COPY_PAGES = 256;
+
+  static constexpr size_t PREFETCH_MIN_SIZE = 65536;  // bytes
+  static constexpr size_t MIN_SCAN_RANGE_SIZE = 1048576;  // bytes, the least a thread of scan_used() steps through
+  static constexpr size_t RESIDENCY_REGION_SIZE = 2097152;  // bytes, the unit of read tracking and deactivation
+
+  static constexpr std::chrono::milliseconds PUNCH_INTERVAL{100};
+  static constexpr size_t MAX_PENDING_PUNCH_SIZE = 67108864;  // bytes, the puncher doesn't wait out the interval past this
 
   int m_fd;
-  int m_db_size;  // size of buffer in bytes
+  size_t m_db_size;  // size of buffer in bytes
   uint8_t * m_base;
+  bool m_volatile;
+  Pages m_pages;
   mutable std::mutex m_mutex;
   BufferHeader * m_header;
+
+  size_t m_page_size;
+  std::vector<std::atomic<uint64_t>> m_dirty_pages;  // bitmap, one bit per page
+  std::mutex m_sync_mutex;  // a sync doesn't return until the pages it took off the bitmap are written back
+  std::atomic<uint64_t> m_num_synced_pages;
+
+  std::mutex m_copy_mutex;  // one copy_to() at a time
+  std::vector<std::atomic<uint64_t>> m_copy_dirty_pages;  // bitmap of the pages written since copy_to() copied them
+  std::atomic<uint64_t> m_num_copied_pages;
+  std::atomic<uint64_t> m_longest_copy_pause;  // microseconds
+  const uint64_t m_copy_session;  // tells this buffer's backups from those of an earlier open
+  uint64_t m_copy_sequence;  // number of copies made, guarded by m_copy_mutex
+
+  // ranges freed since the last punch_holes(), which only punches the parts that are still free
+  std::mutex m_punch_mutex;  // taken after m_mutex, when both are
+  std::condition_variable m_punch_requested;
+  std::vector<std::pair<FileByteOffset, size_t>> m_pending_punches;
+  size_t m_pending_punch_size;
+  // holes punch_holes() is punching without m_mutex held, as [start, end) offsets, guarded by m_mutex
+  std::vector<std::pair<FileByteOffset, FileByteOffset>> m_punching_holes;
+  std::condition_variable m_holes_punched;
+  bool m_closing;
+  std::atomic<bool> m_can_punch;  // until the file system turns out not to support it
+  AllocatorParams m_allocator_params;
+  std::atomic<uint64_t> m_num_punched_holes;
+  std::atomic<uint64_t> m_num_punched_bytes;
+  std::thread m_puncher;  // not running while paused
+
+  std::mutex m_residency_mutex;
+  std::condition_variable m_residency_changed;
+  Residency m_residency;  // guarded by m_residency_mutex
+  bool m_stop_residency;  // guarded by m_residency_mutex
+  std::thread m_residency_manager;  // runs if there's a background warm-up or cold_after is set
+  std::atomic<bool> m_prefetch_large_reads;
+  std::atomic<bool> m_track_reads;
+  mutable std::vector<std::atomic<uint64_t>> m_read_regions;  // bitmap, one bit per region read from since the last check
+  std::vector<bool> m_cold_regions;  // deactivated and not read from since, used by m_residency_manager only
+  std::vector<std::pair<void *, size_t>> m_locked_ranges;  // guarded by m_residency_mutex
+  std::atomic<uint64_t> m_num_warmed_bytes;
+  std::atomic<uint64_t> m_num_deactivated_regions;
 };
 
 #endif  // _FILE_BACKED_BUFFER_HPP_
@@ -105,6 +105,15 @@ bool FileBackedBuffer::dump_usage(const std::string & filename) const
     diagram_image.set_pixel(i, RGB_OVERHEAD);
   }
 
+  // plot space occupied by the root block, it's all overhead as far as the buffer is concerned
+  if (m_header->root_block_offset != NULL_OFFSET) {
+    const Block * root_block = reinterpret_cast<Block *>(to_pointer(m_header->root_block_offset));
+    unsigned int pixel_offset = m_header->root_block_offset / NUM_BYTES_PER_PIXEL;
+    for (unsigned int i = 0; i < (sizeof(Block) + root_block->data_size) / NUM_BYTES_PER_PIXEL; ++i) {
+      diagram_image.set_pixel(pixel_offset + i, RGB_OVERHEAD);
+    }
+  }
+
   // plot space occupied by used blocks
   FileByteOffset curr_used_block_offset = m_header->next_used_block_offset;
   while (curr_used_block_offset != NULL_OFFSET) {
@@ -0,0 +1,271 @@
+#ifndef _FIXED_SIZE_HASH_TABLE_HPP_
+#define _FIXED_SIZE_HASH_TABLE_HPP_
+
+#include <iostream>
+#include <functional>
+#include <type_traits>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <cassert>
+
+#include "file_backed_buffer.hpp"
+
+// a key-value store specialized at compile time for trivially copyable keys and values, e.g. uint64_t keys
+// the records are stored inline in one dense array of fixed size slots (the root block of the buffer), so there is no
+// per-record allocator metadata, no string hashing and no NUL terminated encoding, and a lookup is one probe sequence
+// collisions are resolved with open addressing / linear probing, which suits slots of a constant, small size
+// it locks on writes and is lockless on reads, with a sequence lock per slot so values can be overwritten in place
+// a slot holds two copies of its value, and an overwrite writes the one readers aren't using before switching them over,
+// so that a crash part way through an overwrite leaves the previous value. a crash part way through adding a key
+// discards the slot, which loses only the key that was being added
+// writes are marked dirty in the buffer, and are on disk once sync() returns or the table is closed
+template <typename K, typename V, typename Hash = std::hash<K>>
+class FixedSizeHashTable
+{
+  static_assert(std::is_trivially_copyable<K>::value, "keys of a FixedSizeHashTable must be trivially copyable");
+  static_assert(std::is_trivially_copyable<V>::value, "values of a FixedSizeHashTable must be trivially copyable");
+
+  static constexpr uint64_t EMPTY = 0;                    // sequence of a slot that was never written
+  static constexpr uint64_t TOMBSTONE = ~uint64_t(0);     // sequence of a slot lost to a crash mid-write
+
+  struct Slot {
+    uint64_t seq;  // sequence lock, odd while a key is being added, and goes up by 2 with every write
+    K key;
+    V values[2];   // the current value is values[seq / 2 % 2]
+  };
+
+  // kept at the start of the buffer's root block, followed by the slots
+  struct TableHeader {
+    uint64_t magic;
+    uint64_t key_size;
+    uint64_t value_size;
+    uint64_t capacity;
+    uint64_t size;
+  };
+
+public:
+  static constexpr size_t SLOT_SIZE = sizeof(Slot);
+
+  FixedSizeHashTable(const char * filename, const size_t capacity);
+  ~FixedSizeHashTable();
+
+  // returns false if the table is full
+  bool put(const K & key, const V & value);
+  // returns false if key is not found, leaving value untouched
+  bool get(const K & key, V & value) const;
+
+  // writes what was written since the last sync back to the file, returns once it's on disk
+  bool sync() { return m_buffer.sync(); }
+
+  size_t size() const { return __atomic_load_n(&m_header->size, __ATOMIC_RELAXED); }
+  size_t capacity() const { return m_header->capacity; }
+
+  void print_stats() const;
+
+private:
+  static constexpr uint64_t MAGIC = 0x323030786966766b;  // "kvfix002"
+
+  size_t home_slot(const K & key) const;
+  void write_value(Slot & slot, const uint64_t seq, const V & value);
+
+  std::mutex m_write_mutex;
+  FileBackedBuffer m_buffer;
+  TableHeader * m_header;
+  Slot * m_slots;
+  Hash m_hasher;
+};
+
+
+template <typename K, typename V, typename Hash>
+FixedSizeHashTable<K, V, Hash>::FixedSizeHashTable(const char * filename, const size_t capacity) :
+  m_buffer(filename, FileBackedBuffer::size_for_root(sizeof(TableHeader) + capacity * sizeof(Slot))),
+  m_header(nullptr),
+  m_slots(nullptr)
+{
+  uint8_t * root = m_buffer.root();
+  if (root == nullptr) {
+    root = m_buffer.alloc_root(sizeof(TableHeader) + capacity * sizeof(Slot));
+    assert(root != nullptr);
+    m_header = reinterpret_cast<TableHeader *>(root);
+    m_header->magic = MAGIC;
+    m_header->key_size = sizeof(K);
+    m_header->value_size = sizeof(V);
+    m_header->capacity = capacity;
+    m_header->size = 0;
+    m_slots = reinterpret_cast<Slot *>(root + sizeof(TableHeader));
+    memset(static_cast<void *>(m_slots), 0, capacity * sizeof(Slot));
+    m_buffer.mark_dirty(root, sizeof(TableHeader) + capacity * sizeof(Slot));
+    return;
+  }
+
+  m_header = reinterpret_cast<TableHeader *>(root);
+  m_slots = reinterpret_cast<Slot *>(root + sizeof(TableHeader));
+  if (m_header->magic != MAGIC || m_header->key_size != sizeof(K) || m_header->value_size != sizeof(V)) {
+    std::cerr << "[ERROR] " << filename << " holds a table of a different key or value type, or of an older format\n";
+    assert(false);
+  }
+  if (m_header->capacity != capacity) {
+    std::cout << "[INFO] " << filename << " has a capacity of " << m_header->capacity << " slots, not " << capacity << '\n';
+  }
+
+  // a slot left odd was having a key added when the process stopped, its contents can't be trusted
+  // it can't be emptied either, since that would cut off the probe sequences that pass through it
+  // the size is counted again, as it's updated after the slot and might not have made it to the file
+  size_t size = 0;
+  for (size_t i = 0; i < m_header->capacity; ++i) {
+    if (m_slots[i].seq != TOMBSTONE && m_slots[i].seq % 2 != 0) {
+      std::cerr << "[WARN] discarding slot " << i << ", it was being written when the process stopped\n";
+      m_slots[i].seq = TOMBSTONE;
+      m_buffer.mark_dirty(&m_slots[i].seq, sizeof(uint64_t));
+    }
+    if (m_slots[i].seq != EMPTY && m_slots[i].seq != TOMBSTONE) {
+      ++size;
+    }
+  }
+  if (m_header->size != size) {
+    m_header->size = size;
+    m_buffer.mark_dirty(&m_header->size, sizeof(uint64_t));
+  }
+}
+
+template <typename K, typename V, typename Hash>
+FixedSizeHashTable<K, V, Hash>::~FixedSizeHashTable()
+{
+  sync();
+}
+
+template <typename K, typename V, typename Hash>
+bool FixedSizeHashTable<K, V, Hash>::put(const K & key, const V & value)
+{
+  std::unique_lock<std::mutex> write_lock(m_write_mutex);
+
+  const size_t num_slots = m_header->capacity;
+  size_t slot_index = home_slot(key);
+  Slot * tombstone = nullptr;
+  for (size_t i = 0; i < num_slots; ++i, slot_index = (slot_index + 1 == num_slots) ? 0 : slot_index + 1) {
+    Slot & slot = m_slots[slot_index];
+    if (slot.seq == TOMBSTONE) {
+      if (tombstone == nullptr) {
+        tombstone = &slot;
+      }
+      continue;
+    }
+    if (slot.seq == EMPTY) {
+      break;
+    }
+    if (memcmp(&slot.key, &key, sizeof(K)) == 0) {
+      write_value(slot, slot.seq, value);
+      return true;
+    }
+  }
+
+  // a new key goes into the first reusable slot along its probe sequence
+  Slot * slot = tombstone;
+  if (slot == nullptr) {
+    if (m_slots[slot_index].seq != EMPTY) {
+      std::cerr << "[WARN] Failed to insert, all " << num_slots << " slots are in use\n";
+      return false;
+    }
+    slot = &m_slots[slot_index];
+  }
+  const uint64_t seq = (slot->seq == TOMBSTONE) ? EMPTY : slot->seq;
+  __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+  m_buffer.mark_dirty(&slot->seq, sizeof(uint64_t));
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(static_cast<void *>(&slot->key), &key, sizeof(K));
+  write_value(*slot, seq, value);
+  __atomic_store_n(&m_header->size, m_header->size + 1, __ATOMIC_RELAXED);
+  m_buffer.mark_dirty(&m_header->size, sizeof(uint64_t));
+
+  return true;
+}
+
+// the value goes into the copy that the slot's next sequence number selects, which readers of the current one don't
+// read, and the sequence number is stored last. a reader that was reading the copy when a second overwrite came around
+// to it sees the sequence number change, and retries
+template <typename K, typename V, typename Hash>
+void FixedSizeHashTable<K, V, Hash>::write_value(Slot & slot, const uint64_t seq, const V & value)
+{
+  const uint64_t next_seq = seq + 2;
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(static_cast<void *>(&slot.values[next_seq / 2 % 2]), &value, sizeof(V));
+  __atomic_store_n(&slot.seq, next_seq, __ATOMIC_RELEASE);
+  m_buffer.mark_dirty(&slot, sizeof(Slot));
+}
+
+template <typename K, typename V, typename Hash>
+bool FixedSizeHashTable<K, V, Hash>::get(const K & key, V & value) const
+{
+  const size_t num_slots = m_header->capacity;
+  size_t slot_index = home_slot(key);
+  for (size_t i = 0; i < num_slots; ++i, slot_index = (slot_index + 1 == num_slots) ? 0 : slot_index + 1) {
+    const Slot & slot = m_slots[slot_index];
+    uint64_t seq;
+    bool found;
+    V slot_value;
+    do {
+      seq = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+      if (seq == EMPTY) {
+        return false;
+      }
+      if (seq == TOMBSTONE) {
+        found = false;
+        break;
+      }
+      if (seq % 2 != 0) {
+        std::this_thread::yield();
+        continue;
+      }
+      K slot_key;
+      memcpy(static_cast<void *>(&slot_key), &slot.key, sizeof(K));
+      memcpy(static_cast<void *>(&slot_value), &slot.values[seq / 2 % 2], sizeof(V));
+      found = memcmp(&slot_key, &key, sizeof(K)) == 0;
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while (seq % 2 != 0 || __atomic_load_n(&slot.seq, __ATOMIC_RELAXED) != seq);
+
+    if (found) {
+      value = slot_value;
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename K, typename V, typename Hash>
+size_t FixedSizeHashTable<K, V, Hash>::home_slot(const K & key) const
+{
+  // std::hash of an integer is the identity, so mix the bits before reducing them (murmur3's 64 bit finalizer)
+  uint64_t hash = m_hasher(key);
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash % m_header->capacity;
+}
+
+template <typename K, typename V, typename Hash>
+void FixedSizeHashTable<K, V, Hash>::print_stats() const
+{
+  // size() already leaves out the discarded slots, which take up their slots all the same
+  size_t num_tombstones = 0;
+  for (size_t i = 0; i < m_header->capacity; ++i) {
+    if (m_slots[i].seq == TOMBSTONE) {
+      ++num_tombstones;
+    }
+  }
+
+  std::cout << "fixed size hash table stats:\n"
+            << "  key size (bytes): " << sizeof(K) << '\n'
+            << "  value size (bytes): " << sizeof(V) << '\n'
+            << "  slot size (bytes): " << sizeof(Slot) << '\n'
+            << "  key-value pairs: " << size() << '\n'
+            << "  slots: " << capacity() << '\n'
+            << "  discarded slots: " << num_tombstones << '\n'
+            << "  load factor: " << static_cast<float>(size() + num_tombstones) / capacity() << '\n'
+            << '\n';
+}
+
+#endif  // _FIXED_SIZE_HASH_TABLE_HPP_
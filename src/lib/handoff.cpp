@@ -0,0 +1,100 @@
+#include <iostream>
+#include <sys/socket.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdint>
+
+#include "handoff.hpp"
+
+
+constexpr uint64_t HANDOFF_MAGIC = 0x313030666f68766b;  // "kvhof001"
+
+// the most descriptors a single handoff carries
+constexpr size_t MAX_HANDOFF_FDS = 8;
+
+struct HandoffMessage {
+  uint64_t magic;
+  uint64_t num_fds;
+};
+
+bool send_fds(const int socket_fd, const std::vector<int> & fds)
+{
+  if (fds.empty() || fds.size() > MAX_HANDOFF_FDS) {
+    std::cerr << "[ERROR] can't hand off " << fds.size() << " file descriptors\n";
+    return false;
+  }
+
+  HandoffMessage message = {HANDOFF_MAGIC, fds.size()};
+  struct iovec iov = {&message, sizeof(message)};
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)];
+  memset(control, 0, sizeof(control));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+  memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+  ssize_t result;
+  do {
+    result = sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+  } while (result < 0 && errno == EINTR);
+  if (result != sizeof(message)) {
+    int err = errno;
+    std::cerr << "[ERROR] handing off file descriptors failed: " << strerror(err) << '\n';
+    return false;
+  }
+  return true;
+}
+
+std::vector<int> receive_fds(const int socket_fd)
+{
+  HandoffMessage message = {0, 0};
+  struct iovec iov = {&message, sizeof(message)};
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)];
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t result;
+  do {
+    result = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (result < 0 && errno == EINTR);
+  if (result < 0) {
+    int err = errno;
+    std::cerr << "[ERROR] receiving handed off file descriptors failed: " << strerror(err) << '\n';
+    return std::vector<int>();
+  }
+
+  std::vector<int> fds;
+  for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      const size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const size_t first = fds.size();
+      fds.resize(first + num_fds);
+      memcpy(fds.data() + first, CMSG_DATA(cmsg), sizeof(int) * num_fds);
+    }
+  }
+
+  if (result != sizeof(message) || message.magic != HANDOFF_MAGIC || message.num_fds != fds.size()
+      || (msg.msg_flags & MSG_CTRUNC) != 0) {
+    std::cerr << "[ERROR] received a malformed handoff\n";
+    for (const int fd : fds) {
+      close(fd);
+    }
+    return std::vector<int>();
+  }
+  return fds;
+}
@@ -0,0 +1,12 @@
+#ifndef _HANDOFF_HPP_
+#define _HANDOFF_HPP_
+
+#include <vector>
+
+// passes open file descriptors to another process over a unix domain socket (SCM_RIGHTS), e.g. to hand a store over
+// to the process replacing this one. the receiving process gets its own descriptors of the same open files
+bool send_fds(const int socket_fd, const std::vector<int> & fds);
+// blocks until the other end calls send_fds(), returns an empty vector on failure
+std::vector<int> receive_fds(const int socket_fd);
+
+#endif  // _HANDOFF_HPP_
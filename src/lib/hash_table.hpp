@@ -3,13 +3,21 @@
 
 #include <vector>
 #include <deque>
+#include <unordered_set>
 #include <string>
 #include <functional>
 #include <atomic>
 #include <mutex>
 #include <memory>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
 
 #include "file_backed_buffer.hpp"
+#include "huge_pages.hpp"
+#include "hash_table_policies.hpp"
+#include "write_ahead_log.hpp"
 
 // using a hash table to implement the key-value store mechanism
 // it locks on writes and is lockless on reads (except when the last reader of an expiring value needs to deallocate,
@@ -18,17 +26,85 @@
 // collisions are resolved with open hashing / separate chaining instead of closed hashing / open addressing
 // since the keys are strings of arbitrary length, which have infinitely many possibilities, a separate chainining
 // hash table can technically keep accepting new keys indefinitely, so the hash table has less need to resize
-class ConcurrentHashTable
+// the hash function, the allocator of the records and how records are reclaimed are policies (see
+// hash_table_policies.hpp). ConcurrentHashTable is the default configuration, and the only one compiled into the
+// library, other configurations need to include hash_table_impl.hpp
+template <typename HashPolicy = StdHash,
+          typename AllocatorPolicy = FileBackedBuffer,
+          typename ReclamationPolicy = SharedPtrReclamation>
+class BasicConcurrentHashTable
 {
+  using RecordHandle = typename ReclamationPolicy::Handle;
+
   class BufferFreer
   {
   public:
-    BufferFreer(ConcurrentHashTable * parent) : m_parent(parent) {}
+    // prev_record is the record a merge delta applies to, kept alive for as long as the delta is
+    BufferFreer(BasicConcurrentHashTable * parent, RecordHandle prev_record = RecordHandle()) :
+      m_parent(parent), m_prev_record(std::move(prev_record)) {}
 
-    void operator()(const char * ptr) { m_parent->m_buffer.free(reinterpret_cast<const uint8_t *>(ptr)); }
+    void operator()(const char * ptr) { m_parent->free_record(reinterpret_cast<const uint8_t *>(ptr)); }
 
   private:
-    ConcurrentHashTable * m_parent;
+    BasicConcurrentHashTable * m_parent;
+    RecordHandle m_prev_record;
+  };
+
+  enum class RecordType : uint32_t {
+    VALUE,  // holds the whole value
+    DELTA,  // holds an operand for the merge operator, to be applied to the value of the record it follows
+    COUNTER // holds an int64_t, updated atomically in place
+  };
+
+  // every write is part of a commit (a put() is a commit of one record) with a sequence number one greater than the
+  // last. a commit takes effect for recovery the moment TableHeader::committed_seq is updated to its sequence number,
+  // so records staged by a commit that never finished are discarded on restart, as are records that were replaced
+  struct RecordHeader {
+    uint64_t commit_seq;      // sequence number of the commit that wrote this record, 0 while being allocated
+    uint64_t superseded_seq;  // sequence number of the commit that replaced this record, 0 while it's current
+    uint64_t version;         // starts at 1 for a new key, and goes up by 1 every time the key is written
+    RecordType type;
+    uint32_t chain_length;    // number of DELTA records from this one back to the VALUE record
+    FileByteOffset prev_record_offset;  // record that a DELTA record applies to, the record it supersedes
+    uint64_t overwrite_seq;   // sequence lock for overwriting a VALUE record in place, odd while being overwritten
+    uint32_t data_length;     // bytes of key and value after the header, with their terminators (only the key's for a COUNTER)
+    uint32_t checksum;        // CRC-32C of commit_seq, version, type, chain_length, prev_record_offset and the data_length bytes after the header
+  };
+
+  // kept in the buffer's root block
+  struct TableHeader {
+    uint64_t magic;
+    uint64_t committed_seq;
+    FileByteOffset index_snapshot_offset;  // the index as of the last clean shutdown, if it hasn't been loaded since
+  };
+
+  // a snapshot of the index is a header followed by a node per record, grouped by their slot in m_hash_table
+  struct IndexSnapshotHeader {
+    uint64_t magic;
+    uint64_t checksum;  // CRC-32C of the rest of the header and the nodes
+    uint64_t committed_seq;  // of the table when the snapshot was taken
+    uint64_t hash_table_size;
+    uint64_t num_nodes;
+  };
+
+  // the records a recovery thread found, and what to do with them
+  struct RecoveredRecord {
+    uint8_t * record;
+    size_t hash_table_index;
+    bool is_delta;
+  };
+  struct RecoveryShard {
+    std::vector<RecoveredRecord> current_records;
+    std::vector<const uint8_t *> superseded_records;
+    std::vector<const uint8_t *> stale_records;
+    std::vector<const uint8_t *> quarantined_records;
+    size_t num_torn_records = 0;
+  };
+
+  struct IndexSnapshotNode {
+    uint32_t hash_table_index;
+    uint32_t is_delta;  // so that only the records of merge chains need to be read to load the index
+    FileByteOffset record_offset;
   };
 
   class KeyValuePair
@@ -36,21 +112,69 @@ class ConcurrentHashTable
   public:
     KeyValuePair() {}
 
-    // overwrite contents in key_value_data with key and value
-    void set(char * key_value_data, BufferFreer deleter, const std::string & key, const std::string & value);
+    // overwrite contents in record_data with a record header, key and value
+    static void write(char * record_data,
+                      const uint64_t commit_seq,
+                      const uint64_t version,
+                      const std::string & key,
+                      const std::string & value);
+
+    // overwrite contents in record_data with a DELTA record header, key and merge operand
+    static void write_delta(char * record_data,
+                            const uint64_t commit_seq,
+                            const RecordHeader * prev_record_header,
+                            const FileByteOffset prev_record_offset,
+                            const std::string & key,
+                            const std::string & delta);
+
+    // overwrite contents in record_data with a COUNTER record header, key and value
+    static void write_counter(char * record_data,
+                              const uint64_t commit_seq,
+                              const uint64_t version,
+                              const std::string & key,
+                              const int64_t value);
+
+    // the checksum covers what doesn't change once a record is written, except for the value of a VALUE record
+    // overwritten in place, which is sealed again along with the overwrite. the counter of a COUNTER record isn't covered
+    static uint32_t checksum_of(const RecordHeader * record_header);
+    static void seal(RecordHeader * record_header) { record_header->checksum = checksum_of(record_header); }
 
-    // don't overwrite contents in key_value_data, key and value already preside there
-    void set(char * key_value_data, BufferFreer deleter);
+    // the value of a COUNTER record is aligned for atomic access, after the key
+    static size_t counter_offset(const size_t key_length) { return (key_length + 1 + alignof(int64_t) - 1) & ~(alignof(int64_t) - 1); }
+    static int64_t * counter_of(const char * key) { return reinterpret_cast<int64_t *>(const_cast<char *>(key) + counter_offset(strlen(key))); }
 
-    std::pair<std::shared_ptr<const char>, const char *> get() const;
+    // the header of the record holding key, as returned by get()
+    static const RecordHeader * header_of(const char * key) { return reinterpret_cast<const RecordHeader *>(key - sizeof(RecordHeader)); }
+
+    // don't overwrite contents in record_data, the record already presides there
+    void set(char * record_data, BufferFreer deleter);
+
+    // marks the current record as replaced by the commit with sequence number commit_seq
+    void supersede(const uint64_t commit_seq);
+
+    // header of the current record. for writers only, which are serialized
+    const RecordHeader * header() const { return reinterpret_cast<const RecordHeader *>(m_record_data.get()); }
+    uint64_t version() const { return header()->version; }
+
+    // returns the key (pointing into, and keeping alive, the whole record) and the value
+    std::pair<RecordHandle, const char *> get() const;
+    // starts loading what get() is going to touch
+    void prefetch() const { ReclamationPolicy::prefetch(m_record_data); }
 
   private:
+    // write() without sealing the record
+    static void fill(char * record_data,
+                     const uint64_t commit_seq,
+                     const uint64_t version,
+                     const std::string & key,
+                     const std::string & value);
+
     // this is one of the two places where reader-writer contention may occur
     // when reader wants to access and writer wants to update the same bucket
     // resolved with atomic load/store of this pointer. this also meets the strongly consistent requirement
     // writer-writer contention does not occur because second writer is locked out
     // at the beginning of put()
-    std::shared_ptr<const char> m_key_value_data; // <key> + '\0' + <value> + '\0'
+    RecordHandle m_record_data; // RecordHeader + <key> + '\0' + <value> + '\0'
   };
 
   struct Bucket {
@@ -60,18 +184,157 @@ class ConcurrentHashTable
   };
 
 public:
-  static constexpr char BUFFER_FILENAME[] = "kvstore.bin";
+  static constexpr char BUFFER_FILENAME[] = "kvstore.bin";  // the default store file
+
+  // the allocator's own settings, see FileBackedBuffer for what they are in the default configuration
+  using Pages = typename AllocatorPolicy::Pages;
+  using AllocatorParams = typename AllocatorPolicy::AllocatorParams;
+  using Residency = typename AllocatorPolicy::Residency;
+
+  // the msync() based modes don't order the writes to the file, so a power loss part way through writing back the
+  // pages of a commit can still tear it. only LOG can redo a torn commit
+  // with SYNC and LOG, a write that couldn't be made durable fails (put_batch() returns 0). one that failed to sync is
+  // visible until the store is reopened, but may not survive a crash. one that failed to be logged isn't made at all
+  enum class Durability {
+    NONE,      // writes reach the disk whenever the kernel writes back the mapping, a power loss can lose any of them
+    PERIODIC,  // a background thread writes back the pages written to, every FLUSH_INTERVAL
+    SYNC,      // the pages a write touched are written back before it returns
+    LOG,       // writes are on disk in a write-ahead log by the time they return, and are redone from it on restart
+    VOLATILE   // the store is in memory only, with no file, and is gone with the process (or the last one handed to)
+  };
 
-  ConcurrentHashTable();
+  // how the index is rebuilt when the last shutdown didn't save it (or crashed)
+  enum class Recovery {
+    SERIAL,     // follow the used list, in the order the records were allocated
+    PARALLEL,   // scan the records in the order they are in the file, split across threads
+    BACKGROUND  // as PARALLEL, but the constructor returns right away. lookups wait until the part of the index they
+                // need is built (with Durability::LOG, until the whole log is redone too), writers until all of it is
+  };
+
+  // combines an existing value with a delta into the new value
+  using MergeOperator = std::function<std::string(const std::string & existing_value, const std::string & delta)>;
+
+  // where a store lives and how it's sized. each table needs a path of its own, so that several can be open in one
+  // process. pages is what the store file's mapping is backed by, see Pages, and with anything but NORMAL the index is
+  // put on transparent huge pages too
+  struct Options {
+    std::string path = BUFFER_FILENAME;  // the store file, its log goes next to it, see log_path_of()
+    size_t buffer_size = 536870912;      // bytes, of a new store file. an existing one keeps the size it was made with
+    size_t expected_keys = 200000;       // the index is sized for this many keys at a 75% load factor
+    Durability durability = Durability::NONE;
+    Recovery recovery = Recovery::PARALLEL;
+    Pages pages = Pages::NORMAL;
+    AllocatorParams allocator;
+    // what merge() combines values with, appends the delta to the existing value when not set. it is not persisted,
+    // so pass the same one every time the store is opened: log entries redone while opening are merged with it
+    MergeOperator merge_operator;
+  };
+
+  explicit BasicConcurrentHashTable(const Options & options);
+  // the store at BUFFER_FILENAME with the default sizes
+  explicit BasicConcurrentHashTable(const Durability durability = Durability::NONE,
+                                    const Recovery recovery = Recovery::PARALLEL,
+                                    const Pages pages = Pages::NORMAL);
+  ~BasicConcurrentHashTable();
+
+  // hands the store over to another process, e.g. the next version of this one, so that it can take over without
+  // reopening the files or rebuilding the index. the index goes along in the buffer, saved as at a clean shutdown,
+  // and the buffer and log files are passed as file descriptors over the unix domain socket socket_fd
+  // call once this process has stopped making requests. after a handoff the table can only be deleted, which leaves
+  // the files to the successor. returns false if the handoff failed, in which case the table can still be used
+  bool hand_off(const int socket_fd);
+  // opens the store handed over by hand_off() at the other end of socket_fd, nullptr if nothing was handed over
+  // the handed over files are used in place of the ones at options.path
+  static std::unique_ptr<BasicConcurrentHashTable> take_over(const int socket_fd, const Options & options);
+  static std::unique_ptr<BasicConcurrentHashTable> take_over(const int socket_fd, const Durability durability = Durability::NONE);
+
+  // the write-ahead log of the store file at path: path with its .bin extension, if any, replaced by .wal
+  static std::string log_path_of(const std::string & path);
+  // the prime number of index slots that holds expected_keys at a 75% load factor
+  static size_t index_size_for(const size_t expected_keys);
 
   // basic functionality requirements: put() and get()
   bool put(const std::string & key, const std::string & value);
   std::string get(const std::string & key); // returns empty string if key is not found
 
+  // optimistic concurrency control for read-modify-write: get_versioned() a value, compute the new value without
+  // holding any lock, then put_if_version() it with the version that was read, and start over if that fails
+  std::pair<std::string, uint64_t> get_versioned(const std::string & key);  // version is 0 if key is not found
+  // only writes if the version of key is still expected_version (0 to only write if key doesn't exist yet)
+  // returns false if the version didn't match or if there wasn't space
+  bool put_if_version(const std::string & key, const std::string & value, const uint64_t expected_version);
+
+  enum class BatchMode {
+    ALL_OR_NOTHING,  // if there isn't space for every key-value pair then none of them are written
+    BEST_EFFORT      // writes as many of the key-value pairs as there is space for
+  };
+
+  // writes a batch of key-value pairs taking the write lock once, with the records allocated in one pass and
+  // contiguously when possible. pairs later in the batch take precedence over earlier ones with the same key
+  // the pairs that are written become visible together, to multi_get() and to recovery after a crash
+  // returns the number of key-value pairs written
+  size_t put_batch(const std::vector<std::pair<std::string, std::string>> & key_value_pairs, const BatchMode mode);
+
+  // a set of puts to be committed together
+  class WriteBatch
+  {
+  public:
+    void put(const std::string & key, const std::string & value) { m_key_value_pairs.emplace_back(key, value); }
+
+    size_t size() const { return m_key_value_pairs.size(); }
+    void clear() { m_key_value_pairs.clear(); }
+
+  private:
+    friend class BasicConcurrentHashTable;
+    std::vector<std::pair<std::string, std::string>> m_key_value_pairs;
+  };
+
+  // atomically applies all of the puts in batch, or none of them if there isn't space
+  // no multi_get() observes only part of a batch, and no restart recovers only part of a batch
+  bool commit(const WriteBatch & batch);
+
+  // checks the checksum of every record a lookup reads, off by default, set it before any reads. a record that fails is reported and read as if
+  // its key wasn't found. recovery always checks, and quarantines the records that fail: they are left allocated in
+  // the buffer for inspection, but not indexed
+  void set_verify_reads(const bool verify_reads) { m_verify_reads = verify_reads; }
+
+  // offsets in the store file of the records quarantined by the last rebuild of the index, for inspection
+  std::vector<FileByteOffset> quarantined_records();
+  // frees the quarantined records once they're no longer wanted, returns how many there were
+  size_t reclaim_quarantined_records();
+
+  // writes a value of the same size as the one it replaces over it in place, under the record's sequence lock, rather
+  // than to a new record. off by default, set it before any writes. an overwrite isn't atomic with respect to a crash:
+  // a record found half overwritten on restart is discarded, and its key with it, unless the durability is LOG, in
+  // which case the overwrite was logged before it started and the key is redone from the log
+  void set_overwrite_in_place(const bool overwrite_in_place) { m_overwrite_in_place = overwrite_in_place; }
+
+  // writes only the delta, which costs in proportion to the delta rather than the whole value
+  // deltas are folded into the value on read, and into a new whole value by the writer once enough have accumulated
+  // merging into a key that doesn't exist merges into an empty value. values are combined with options.merge_operator
+  bool merge(const std::string & key, const std::string & delta);
+
+  // counters are int64_t values updated atomically in place in the buffer, without the write lock or an allocation
+  // (except for the update that creates the counter). a key that doesn't exist counts as a counter with value 0
+  // get() returns counters in decimal. counter updates don't change the version of the key
+  // both return false if the key holds a value that isn't a counter, or if there isn't space to create the counter
+  bool fetch_add(const std::string & key, const int64_t delta, int64_t & previous_value);
+  // like std::atomic::compare_exchange_strong(), expected_value is updated to the current value on a mismatch
+  bool compare_exchange(const std::string & key, int64_t & expected_value, const int64_t desired_value);
+
+  // looks up a batch of keys at once. all keys are hashed up front and the bucket chains are walked interleaved,
+  // with the next node of each chain prefetched, so the cache misses of the different lookups overlap
+  // returns values in the same order as keys, with an empty string for each key that is not found
+  // the values are consistent with respect to put_batch() and commit(): none of them are read from part way through a
+  // batch. other writes are to a single key each, and aren't ordered with the reads, so a multi_get() can see one of
+  // them but not another that was made before it
+  std::vector<std::string> multi_get(const std::vector<std::string> & keys);
+
   class const_iterator
   {
   public:
-    const_iterator(std::deque<Bucket>::const_iterator iter) : m_iter(iter) {}
+    const_iterator(const BasicConcurrentHashTable * parent, typename std::deque<Bucket>::const_iterator iter) :
+      m_parent(parent), m_iter(iter) {}
 
     std::pair<std::string, std::string> operator*();
 
@@ -82,22 +345,124 @@ public:
     bool operator!=(const const_iterator & other) const { return other.m_iter != m_iter; }
 
   private:
-    std::deque<Bucket>::const_iterator m_iter;
+    const BasicConcurrentHashTable * m_parent;
+    typename std::deque<Bucket>::const_iterator m_iter;
   };
 
-  const_iterator begin() const { return m_bucket_storage.cbegin(); }
-  const_iterator end() const { return m_bucket_storage.cend(); }
+  const_iterator begin() const { wait_until_recovered(); return const_iterator(this, m_bucket_storage.cbegin()); }
+  const_iterator end() const { wait_until_recovered(); return const_iterator(this, m_bucket_storage.cend()); }
+
+  // writes a copy of the store file to filename while the store stays in use, as a crash would have left it at a single
+  // moment. writers are paused only for the last few pages copied, see FileBackedBuffer::copy_to(). counters go on
+  // being updated throughout, each counter in the copy has a value it had during the copy. the copy has no index
+  // snapshot and no log, so opening it rebuilds the index
+  bool checkpoint_to(const std::string & filename);
+  // like checkpoint_to(), into a backup directory, where after the first backup only the pages written since the last
+  // one are saved. restore_backup() rebuilds a store file from the backups in directory, see FileBackedBuffer
+  bool backup_to(const std::string & directory);
+  static bool restore_backup(const std::string & directory, const std::string & filename)
+  {
+    return AllocatorPolicy::restore_backup(directory.c_str(), filename.c_str());
+  }
+
+  // see Residency. with lock_metadata, the index is locked in memory too
+  void set_residency(const Residency & residency);
+
+  // whether the index was loaded as saved by the last shutdown, rather than rebuilt from the records
+  bool index_loaded() const { wait_until_recovered(); return m_index_loaded; }
 
   void print_stats() const;
   bool dump_buffer_usage(const std::string & filename) const { return m_buffer.dump_usage(filename); }
 
 private:
+  BasicConcurrentHashTable(const Options & options, const int buffer_fd, const int log_fd);
+
+  static constexpr uint32_t MAX_MERGE_CHAIN_LENGTH = 16;  // merge deltas accumulated before they are folded into a whole value
+  static constexpr uint64_t TABLE_MAGIC = 0x343030656c62746b;  // "ktble004"
+  static constexpr uint64_t INDEX_SNAPSHOT_MAGIC = 0x323030786469746b;  // "ktidx002"
+  // multi_get() walks this many bucket chains at the same time (asynchronous memory access chaining)
+  // enough lookups need to be in flight to cover the memory latency, but not so many that prefetches evict each other
+  static constexpr size_t MULTI_GET_GROUP_SIZE = 16;
+  // the log is emptied once it grows past this, after writing the whole buffer back to the file
+  static constexpr uint64_t LOG_CHECKPOINT_SIZE = 67108864;  // bytes
+  static constexpr std::chrono::milliseconds FLUSH_INTERVAL = std::chrono::milliseconds(1000);
+  // fewer records than this aren't worth starting another thread for
+  static constexpr size_t MIN_RECORDS_PER_RECOVERY_THREAD = 16384;
+  // a background recovery makes the index available to lookups in this many parts, by range of hash table index
+  static constexpr size_t NUM_RECOVERY_PARTITIONS = 64;
+
+  // the index is loaded from the snapshot saved by a clean shutdown if there is one, otherwise rebuilt from the records
+  // then the log is redone. must be called with m_write_mutex held
+  void recover_locked(const Recovery recovery, const std::chrono::steady_clock::time_point start_time, const int log_fd);
+  bool load_index();
+  bool snapshot_intact(const uint8_t * snapshot) const;
+  void rebuild_index(const Recovery recovery);
+  void scan_records(uint8_t * const * begin, uint8_t * const * end, RecoveryShard & shard);
+  bool record_intact(const RecordHeader * record_header) const;
+  bool chain_intact(const RecordHeader * record_header, const std::unordered_set<const uint8_t *> & quarantined_records) const;
+  bool save_index();  // returns false if there was no space for the snapshot
+  static uint32_t snapshot_checksum(const IndexSnapshotHeader * snapshot_header);
+  void index_record(uint8_t * record,
+                    const size_t hash_table_index,
+                    const bool is_delta,
+                    std::unordered_set<const uint8_t *> * chained_records);
+
+  // lookups of keys whose part of the index isn't built yet wait in wait_until_indexed()
+  size_t recovery_partition_of(const size_t hash_table_index) const { return hash_table_index * NUM_RECOVERY_PARTITIONS / m_hash_table.size(); }
+  void set_recovered_partitions(const size_t num_partitions);
+  void wait_until_indexed(const std::string & key) const;
+  void wait_until_recovered() const;
+
+  // deleter of the records. records stay in the buffer file when the table itself goes away, or once it has been
+  // handed off, and ones released during a handoff are only freed if it fails
+  void free_record(const uint8_t * record);
+
   std::pair<Bucket *, size_t> find_bucket_with_key(const std::string & key) const;
+  // the value of the record holding key, with any merge deltas folded in, and optionally the version of the record
+  std::string read_value(const char * key, uint64_t * version = nullptr) const;
+  std::string checksum_failure(const RecordHeader * record_header, uint64_t * version) const;  // reads as not found
   Bucket * get_new_bucket();
   void store_bucket(Bucket * bucket, const size_t hash_table_index);
+  void lookup_interleaved(const std::vector<std::string> & keys,
+                          const std::vector<size_t> & hash_table_indices,
+                          std::vector<std::string> & results) const;
+
+  // write path of put() and put_batch(). must be called with m_write_mutex held
+  // logged_version is the version a write redone from the log had, 0 for a new write
+  bool put_locked(const std::string & key,
+                  const std::string & value,
+                  const std::pair<Bucket *, size_t> & result,
+                  const uint64_t logged_version = 0);
+  bool overwrite_locked(const std::string & key, const std::string & value, const uint64_t version, Bucket * bucket);
+  bool put_counter_locked(const std::string & key, const int64_t value, const std::pair<Bucket *, size_t> & result);
+  void install_locked(uint8_t * data_buffer, const uint64_t commit_seq, const std::pair<Bucket *, size_t> & result);
+  uint64_t begin_commit() const { return m_header->committed_seq + 1; }
+  void end_commit(const uint64_t commit_seq);
+  bool merge_locked(const std::string & key, const std::string & delta);
+
+  // writers log what they are about to write while holding m_write_mutex, so that the log is in commit order and a
+  // write that can't be logged isn't made, and wait for the log (or the pages they wrote) to be synced in
+  // make_durable() after releasing it, so that concurrent writers can share a sync. whatever the mode, everything
+  // written to the buffer is marked dirty in it, after it's written. all return false if the log or sync failed
+  bool append_log_locked(const std::vector<WriteAheadLog::Entry> & entries);
+  void checkpoint_if_full_locked();
+  bool make_durable(std::unique_lock<std::mutex> & write_lock);
+  // counters are updated in place without m_write_mutex, so the update and its log entry are made under the log's lock
+  std::unique_lock<std::mutex> lock_log() { return m_log ? m_log->lock() : std::unique_lock<std::mutex>(); }
+  bool make_counter_durable(std::unique_lock<std::mutex> & log_lock, const char * key, const int64_t value);
+  void checkpoint_locked();
+  void flush_periodically();
+  bool replay_log_entry(const WriteAheadLog::Entry & entry);  // returns false if the buffer already had the write
+
+  void begin_publish() { m_publish_seq.fetch_add(1, std::memory_order_relaxed); std::atomic_thread_fence(std::memory_order_release); }
+  void end_publish() { m_publish_seq.fetch_add(1, std::memory_order_release); }
 
   std::mutex m_write_mutex;
-  FileBackedBuffer m_buffer;
+  AllocatorPolicy m_buffer;
+  TableHeader * m_header;
+  // odd while a writer is publishing a commit to the buckets (a sequence lock)
+  // lets readers of multiple keys check that they didn't straddle a commit
+  std::atomic<uint64_t> m_publish_seq;
   std::deque<Bucket> m_bucket_storage;
   // this is one of the two places where reader-writer contention may occur
   // when reader is searching for the right bucket while writer is adding a bucket.
@@ -105,9 +470,40 @@ private:
   // only the top-level pointer needs to be updated, which is done atomically and with release semantics
   // writer-writer contention does not occur because second writer is locked out
   // at the beginning of put() until first writer completes
-  std::vector<std::atomic<Bucket *>> m_hash_table;
-
-  static constexpr std::hash<std::string> hasher = std::hash<std::string>();
+  std::vector<std::atomic<Bucket *>, HugePageAllocator<std::atomic<Bucket *>>> m_hash_table;
+  const MergeOperator m_merge_operator;  // appends when not set
+  const Durability m_durability;
+  const std::string m_path;
+  std::unique_ptr<WriteAheadLog> m_log;  // only with Durability::LOG
+  uint64_t m_log_lsn;  // log sequence number of the last entries logged by a writer
+  std::thread m_flusher;  // only with Durability::PERIODIC
+  std::mutex m_flusher_mutex;
+  std::condition_variable m_flusher_wakeup;
+  bool m_stop_flusher;
+  std::atomic<bool> m_closing;  // records are no longer freed, checked under m_handoff_mutex
+  std::mutex m_handoff_mutex;
+  bool m_handing_off;
+  std::vector<const uint8_t *> m_deferred_frees;  // released while handing off
+  bool m_handed_off;  // the files belong to the successor, nothing more is written to them
+  bool m_index_loaded;
+  std::chrono::duration<double, std::milli> m_recovery_time;
+  size_t m_recovery_threads;  // 0 if the index was loaded
+  size_t m_num_quarantined_records;
+  std::vector<const uint8_t *> m_quarantined_records;  // guarded by m_write_mutex
+  bool m_verify_reads;
+  bool m_overwrite_in_place;
+  mutable std::atomic<uint64_t> m_num_read_checksum_failures;
+  std::thread m_recoverer;  // only with Recovery::BACKGROUND
+  // partitions of the index that lookups can use, all of them once recovery is done
+  std::atomic<size_t> m_num_recovered_partitions;
+  mutable std::mutex m_recovery_mutex;
+  mutable std::condition_variable m_recovery_progress;
+  HashPolicy m_hasher;
 };
 
+// compiled once in hash_table.cpp
+extern template class BasicConcurrentHashTable<>;
+
+using ConcurrentHashTable = BasicConcurrentHashTable<>;
+
 #endif  // _HASH_TABLE_HPP_
@@ -0,0 +1,1612 @@
+#ifndef _HASH_TABLE_IMPL_HPP_
+#define _HASH_TABLE_IMPL_HPP_
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <future>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/mman.h>
+#include <string_view>
+#include <unistd.h>
+
+#include "hash_table.hpp"
+#include "handoff.hpp"
+#include "crc32c.hpp"
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::BasicConcurrentHashTable(const Options & options) :
+  BasicConcurrentHashTable(options, -1, -1)
+{
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::BasicConcurrentHashTable(const Durability durability,
+                                                                                    const Recovery recovery,
+                                                                                    const Pages pages) :
+  BasicConcurrentHashTable([&]() {
+    Options options;
+    options.durability = durability;
+    options.recovery = recovery;
+    options.pages = pages;
+    return options;
+  }())
+{
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::BasicConcurrentHashTable(const Options & options,
+                                                                                    const int buffer_fd,
+                                                                                    const int log_fd) :
+  m_buffer(options.durability == Durability::VOLATILE ? nullptr : options.path.c_str(), options.buffer_size, buffer_fd,
+           options.pages),
+  m_header(nullptr),
+  m_publish_seq(0),
+  m_hash_table(index_size_for(options.expected_keys),
+               HugePageAllocator<std::atomic<Bucket *>>(options.pages != Pages::NORMAL)),
+  m_merge_operator(options.merge_operator),
+  m_durability(options.durability),
+  m_path(options.path),
+  m_log_lsn(0),
+  m_stop_flusher(false),
+  m_closing(false),
+  m_handing_off(false),
+  m_handed_off(false),
+  m_index_loaded(false),
+  m_recovery_threads(0),
+  m_num_quarantined_records(0),
+  m_verify_reads(false),
+  m_overwrite_in_place(false),
+  m_num_read_checksum_failures(0),
+  m_num_recovered_partitions(0)
+{
+  m_buffer.set_allocator_params(options.allocator);
+  m_header = reinterpret_cast<TableHeader *>(m_buffer.root());
+  if (m_header == nullptr) {
+    m_header = reinterpret_cast<TableHeader *>(m_buffer.alloc_root(sizeof(TableHeader)));
+    assert(m_header != nullptr);
+    m_header->magic = TABLE_MAGIC;
+    m_header->committed_seq = 0;
+    m_header->index_snapshot_offset = NULL_OFFSET;
+    m_buffer.mark_dirty(m_header, sizeof(TableHeader));
+  }
+  assert(m_header->magic == TABLE_MAGIC);
+
+  const auto recovery_start_time = std::chrono::steady_clock::now();
+  const Recovery recovery = options.recovery;
+  if (recovery == Recovery::BACKGROUND) {
+    // writers queue up on m_write_mutex behind the recovery, so it has to be held before the constructor returns
+    std::promise<void> write_locked;
+    std::future<void> write_lock_held = write_locked.get_future();
+    m_recoverer = std::thread([this, recovery, recovery_start_time, log_fd, write_locked = std::move(write_locked)]() mutable {
+      std::unique_lock<std::mutex> write_lock(m_write_mutex);
+      write_locked.set_value();
+      recover_locked(recovery, recovery_start_time, log_fd);
+    });
+    write_lock_held.wait();
+  } else {
+    std::unique_lock<std::mutex> write_lock(m_write_mutex);
+    recover_locked(recovery, recovery_start_time, log_fd);
+  }
+
+  if (m_durability == Durability::PERIODIC) {
+    m_flusher = std::thread(&BasicConcurrentHashTable::flush_periodically, this);
+  }
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::string BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::log_path_of(const std::string & path)
+{
+  static constexpr char BUFFER_EXTENSION[] = ".bin";
+  const size_t extension_length = strlen(BUFFER_EXTENSION);
+  if (path.size() > extension_length && path.compare(path.size() - extension_length, extension_length, BUFFER_EXTENSION) == 0) {
+    return path.substr(0, path.size() - extension_length) + ".wal";
+  }
+  return path + ".wal";
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+size_t BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::index_size_for(const size_t expected_keys)
+{
+  // a prime number of slots spreads keys evenly even when the hash has patterns in its low bits
+  const auto is_prime = [](const size_t n) {
+    for (size_t divisor = 2; divisor * divisor <= n; ++divisor) {
+      if (n % divisor == 0) {
+        return false;
+      }
+    }
+    return true;
+  };
+  size_t size = std::max<size_t>(expected_keys * 4 / 3, 2);
+  while (!is_prime(size)) {
+    ++size;
+  }
+  return size;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::recover_locked(const Recovery recovery,
+                                                                                    const std::chrono::steady_clock::time_point start_time,
+                                                                                    const int log_fd)
+{
+  m_index_loaded = load_index();
+  if (!m_index_loaded) {
+    rebuild_index(recovery);
+  }
+  m_recovery_time = std::chrono::steady_clock::now() - start_time;
+
+  if (m_durability == Durability::LOG) {
+    // redo what the log has that the buffer lost, before the log is set up to take new entries
+    std::unique_ptr<WriteAheadLog> log = std::make_unique<WriteAheadLog>(log_path_of(m_path).c_str(), log_fd);
+    size_t num_redone = 0;
+    const size_t num_replayed = log->replay([this, &num_redone](const WriteAheadLog::Entry & entry) {
+      num_redone += replay_log_entry(entry);
+    });
+    if (num_replayed > 0) {
+      std::cout << "[INFO] redid " << num_redone << " of " << num_replayed << " log entries\n";
+    }
+    m_log = std::move(log);
+    checkpoint_locked();
+  } else if (log_fd >= 0) {
+    close(log_fd);
+  }
+  set_recovered_partitions(NUM_RECOVERY_PARTITIONS);
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::rebuild_index(const Recovery recovery)
+{
+  // load what's already in the on-disk buffer
+  std::vector<RecoveryShard> shards;
+  if (recovery == Recovery::SERIAL) {
+    const std::vector<uint8_t *> records = m_buffer.list_used();
+    shards.resize(1);
+    scan_records(records.data(), records.data() + records.size(), shards[0]);
+  } else {
+    // in the order the records are in the file, split into contiguous ranges that each thread reads front to back
+    const std::vector<uint8_t *> records = m_buffer.scan_used(std::thread::hardware_concurrency());
+    const size_t num_threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(),
+                                                                    records.size() / MIN_RECORDS_PER_RECOVERY_THREAD));
+    shards.resize(num_threads);
+    std::vector<std::thread> threads; threads.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+      uint8_t * const * begin = records.data() + records.size() * i / num_threads;
+      uint8_t * const * end = records.data() + records.size() * (i + 1) / num_threads;
+      threads.emplace_back(&BasicConcurrentHashTable::scan_records, this, begin, end, std::ref(shards[i]));
+    }
+    for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+      iter->join();
+    }
+  }
+  m_recovery_threads = shards.size();
+
+  // merge the shards into the index a partition at a time, so that lookups in the partitions done so far can go ahead
+  // while the rest are built. without a log to redo, a partition can be used as soon as it's in the index
+  std::vector<std::vector<const RecoveredRecord *>> partitions(NUM_RECOVERY_PARTITIONS);
+  for (const RecoveryShard & shard : shards) {
+    for (const RecoveredRecord & recovered : shard.current_records) {
+      partitions[recovery_partition_of(recovered.hash_table_index)].push_back(&recovered);
+    }
+  }
+  std::unordered_set<const uint8_t *> quarantined_records;
+  for (const RecoveryShard & shard : shards) {
+    quarantined_records.insert(shard.quarantined_records.begin(), shard.quarantined_records.end());
+  }
+  m_quarantined_records.assign(quarantined_records.begin(), quarantined_records.end());
+
+  // superseded records are still needed if a current DELTA record applies to them
+  std::unordered_set<const uint8_t *> chained_records;
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    for (const RecoveredRecord * recovered : partitions[i]) {
+      // the value of a DELTA record is lost along with any record in its chain
+      if (recovered->is_delta && !chain_intact(reinterpret_cast<const RecordHeader *>(recovered->record), quarantined_records)) {
+        m_quarantined_records.push_back(recovered->record);
+        continue;
+      }
+      index_record(recovered->record, recovered->hash_table_index, recovered->is_delta, &chained_records);
+    }
+    if (m_durability != Durability::LOG) {
+      set_recovered_partitions(i + 1);
+    }
+  }
+
+  size_t num_discarded = 0;
+  size_t num_torn = 0;
+  for (const RecoveryShard & shard : shards) {
+    for (const uint8_t * record : shard.superseded_records) {
+      if (chained_records.count(record) == 0) {
+        m_buffer.free(record);
+        ++num_discarded;
+      }
+    }
+    for (const uint8_t * record : shard.stale_records) {
+      m_buffer.free(record);
+      ++num_discarded;
+    }
+    num_torn += shard.num_torn_records;
+  }
+  m_num_quarantined_records = m_quarantined_records.size();
+  if (m_num_quarantined_records > 0) {
+    std::cerr << "[WARN] quarantined " << m_num_quarantined_records << " records that failed their checksum or depend on one that did,"
+              << " they are left allocated in the buffer but not indexed until reclaim_quarantined_records()\n";
+  }
+  if (num_torn > 0) {
+    std::cerr << "[WARN] " << num_torn << " of the quarantined records were being overwritten in place when the process stopped, "
+              << (m_durability == Durability::LOG ? "their keys are redone from the log\n" : "their keys are lost\n");
+  }
+  if (num_discarded > 0) {
+    std::cout << "[INFO] discarded " << num_discarded << " records from unfinished or superseded commits\n";
+  }
+}
+
+// sorts the records from begin to end into shard, hashing the keys of the current ones. safe to run concurrently on
+// different records, as it only writes to the records themselves
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::scan_records(uint8_t * const * begin, uint8_t * const * end, RecoveryShard & shard)
+{
+  const uint64_t committed_seq = m_header->committed_seq;
+  for (uint8_t * const * iter = begin; iter != end; ++iter) {
+    uint8_t * record = *iter;
+
+    // skip records from commits that never finished, whether or not they were written in full: the allocator zeroes
+    // commit_seq, so a record still being written when the process stopped is one of them rather than torn
+    RecordHeader * record_header = reinterpret_cast<RecordHeader *>(record);
+    if (record_header->commit_seq == 0 || record_header->commit_seq > committed_seq) {
+      shard.stale_records.push_back(record);
+      continue;
+    }
+
+    // a committed record that doesn't match its checksum was torn by a crash while it was being overwritten in place,
+    // or corrupted some other way. nothing else in its header can be trusted, not even to decide that it may be freed
+    if (!record_intact(record_header)) {
+      shard.quarantined_records.push_back(record);
+      shard.num_torn_records += (record_header->overwrite_seq % 2 != 0);
+      continue;
+    }
+
+    // an overwrite in place that was sealed but not yet unlocked when the process stopped, the record is whole
+    if (record_header->overwrite_seq % 2 != 0) {
+      record_header->overwrite_seq += 1;
+      m_buffer.mark_dirty(&record_header->overwrite_seq, sizeof(uint64_t));
+    }
+    // skip records that a finished commit replaced
+    if (record_header->superseded_seq != 0) {
+      if (record_header->superseded_seq <= committed_seq) {
+        shard.superseded_records.push_back(record);
+        continue;
+      }
+      // the replacing commit never finished, and its sequence number is going to be reused
+      record_header->superseded_seq = 0;
+      m_buffer.mark_dirty(record_header, sizeof(RecordHeader));
+    }
+
+    const size_t hash_table_index = m_hasher(reinterpret_cast<const char *>(record) + sizeof(RecordHeader)) % m_hash_table.size();
+    shard.current_records.push_back({record, hash_table_index, record_header->type == RecordType::DELTA});
+  }
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::record_intact(const RecordHeader * record_header) const
+{
+  const uint8_t * record = reinterpret_cast<const uint8_t *>(record_header);
+  return sizeof(RecordHeader) + record_header->data_length <= m_buffer.size_of(record)
+         && KeyValuePair::checksum_of(record_header) == record_header->checksum;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::chain_intact(const RecordHeader * record_header,
+                                                                                            const std::unordered_set<const uint8_t *> & quarantined_records) const
+{
+  while (record_header->type == RecordType::DELTA) {
+    record_header = reinterpret_cast<const RecordHeader *>(m_buffer.pointer_at(record_header->prev_record_offset));
+    if (quarantined_records.count(reinterpret_cast<const uint8_t *>(record_header)) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::index_record(uint8_t * record,
+                                                                                            const size_t hash_table_index,
+                                                                                            const bool is_delta,
+                                                                                            std::unordered_set<const uint8_t *> * chained_records)
+{
+  // a DELTA record keeps the records it applies to alive, back to the whole value
+  RecordHandle prev_record;
+  if (is_delta) {
+    std::vector<uint8_t *> chain = {record};
+    while (reinterpret_cast<const RecordHeader *>(chain.back())->type == RecordType::DELTA) {
+      chain.push_back(m_buffer.pointer_at(reinterpret_cast<const RecordHeader *>(chain.back())->prev_record_offset));
+      if (chained_records != nullptr) {
+        chained_records->insert(chain.back());
+      }
+    }
+
+    // oldest first, so that each record can keep the one it applies to alive
+    for (auto iter = chain.rbegin(); iter + 1 != chain.rend(); ++iter) {
+      prev_record = ReclamationPolicy::make(reinterpret_cast<const char *>(*iter), BufferFreer(this, std::move(prev_record)));
+    }
+  }
+
+  Bucket * new_bucket = get_new_bucket();
+  new_bucket->key_value_pair.set(reinterpret_cast<char *>(record), BufferFreer(this, std::move(prev_record)));
+  store_bucket(new_bucket, hash_table_index);
+}
+
+// a snapshot is only valid if nothing was committed between the shutdown that saved it and now. either way it's
+// discarded, since the index is going to change from here on
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::load_index()
+{
+  if (m_header->index_snapshot_offset == NULL_OFFSET) {
+    return false;
+  }
+  if (!m_buffer.allocation_in_bounds(m_header->index_snapshot_offset)) {
+    std::cerr << "[ERROR] the index snapshot offset " << m_header->index_snapshot_offset << " is invalid, rebuilding the index\n";
+    m_header->index_snapshot_offset = NULL_OFFSET;
+    m_buffer.mark_dirty(m_header, sizeof(TableHeader));
+    return false;
+  }
+  uint8_t * snapshot = m_buffer.pointer_at(m_header->index_snapshot_offset);
+  const IndexSnapshotHeader * snapshot_header = reinterpret_cast<const IndexSnapshotHeader *>(snapshot);
+  const bool valid = snapshot_intact(snapshot)
+                     && snapshot_header->committed_seq == m_header->committed_seq
+                     && snapshot_header->hash_table_size == m_hash_table.size();
+
+  if (valid) {
+    // stored so that pushing each node onto the front of its chain puts the chains back in the same order
+    const IndexSnapshotNode * nodes = reinterpret_cast<const IndexSnapshotNode *>(snapshot + sizeof(IndexSnapshotHeader));
+    for (size_t i = 0; i < snapshot_header->num_nodes; ++i) {
+      index_record(m_buffer.pointer_at(nodes[i].record_offset), nodes[i].hash_table_index, nodes[i].is_delta != 0, nullptr);
+    }
+    std::cout << "[INFO] loaded the index of " << snapshot_header->num_nodes << " records saved at the last shutdown\n";
+  } else {
+    std::cout << "[INFO] the index saved at the last shutdown is out of date, rebuilding it\n";
+  }
+
+  m_header->index_snapshot_offset = NULL_OFFSET;
+  m_buffer.mark_dirty(m_header, sizeof(TableHeader));
+  m_buffer.free(snapshot);
+  return valid;
+}
+
+// a snapshot that was torn by a crash, or is left over from an earlier one, must not lead the index to wild pointers:
+// it's checksummed, and every node is checked to be in bounds (and the chain of every merge delta with it) before any
+// of them is followed
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::snapshot_intact(const uint8_t * snapshot) const
+{
+  const IndexSnapshotHeader * snapshot_header = reinterpret_cast<const IndexSnapshotHeader *>(snapshot);
+  const size_t snapshot_size = m_buffer.size_of(snapshot);
+  if (snapshot_size < sizeof(IndexSnapshotHeader) || snapshot_header->magic != INDEX_SNAPSHOT_MAGIC
+      || snapshot_header->num_nodes > (snapshot_size - sizeof(IndexSnapshotHeader)) / sizeof(IndexSnapshotNode)
+      || snapshot_header->checksum != snapshot_checksum(snapshot_header)) {
+    std::cerr << "[ERROR] the index snapshot is damaged\n";
+    return false;
+  }
+
+  const IndexSnapshotNode * nodes = reinterpret_cast<const IndexSnapshotNode *>(snapshot + sizeof(IndexSnapshotHeader));
+  for (size_t i = 0; i < snapshot_header->num_nodes; ++i) {
+    bool in_bounds = nodes[i].hash_table_index < m_hash_table.size() && m_buffer.allocation_in_bounds(nodes[i].record_offset);
+    FileByteOffset record_offset = nodes[i].record_offset;
+    for (uint32_t chain_length = 0; in_bounds && nodes[i].is_delta != 0; ++chain_length) {
+      const RecordHeader * record_header = reinterpret_cast<const RecordHeader *>(m_buffer.pointer_at(record_offset));
+      if (record_header->type != RecordType::DELTA) {
+        break;
+      }
+      record_offset = record_header->prev_record_offset;
+      in_bounds = chain_length < MAX_MERGE_CHAIN_LENGTH && m_buffer.allocation_in_bounds(record_offset);
+    }
+    if (!in_bounds) {
+      std::cerr << "[ERROR] the index snapshot has an invalid node for the record at offset " << nodes[i].record_offset << '\n';
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+uint32_t BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::snapshot_checksum(const IndexSnapshotHeader * snapshot_header)
+{
+  // the nodes follow the header
+  const size_t checksummed_size = sizeof(IndexSnapshotHeader) - offsetof(IndexSnapshotHeader, committed_seq)
+                                  + snapshot_header->num_nodes * sizeof(IndexSnapshotNode);
+  return crc32c(&snapshot_header->committed_seq, checksummed_size);
+}
+
+// saves the index to the buffer, for the next open to load. called at a clean shutdown, once writers are done
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::save_index()
+{
+  const size_t num_nodes = m_bucket_storage.size();
+  const size_t snapshot_size = sizeof(IndexSnapshotHeader) + num_nodes * sizeof(IndexSnapshotNode);
+  uint8_t * snapshot = m_buffer.alloc(snapshot_size);
+  if (snapshot == nullptr) {
+    std::cerr << "[WARN] no space to save the index, it will be rebuilt on the next open\n";
+    return false;
+  }
+
+  IndexSnapshotNode * nodes = reinterpret_cast<IndexSnapshotNode *>(snapshot + sizeof(IndexSnapshotHeader));
+  size_t node_index = 0;
+  std::vector<const Bucket *> chain;
+  for (size_t i = 0; i < m_hash_table.size(); ++i) {
+    chain.clear();
+    for (const Bucket * bucket = m_hash_table[i].load(std::memory_order_acquire); bucket != nullptr; bucket = bucket->next_bucket) {
+      chain.push_back(bucket);
+    }
+    for (auto iter = chain.rbegin(); iter != chain.rend(); ++iter) {
+      const RecordHeader * record_header = (*iter)->key_value_pair.header();
+      nodes[node_index].hash_table_index = i;
+      nodes[node_index].is_delta = record_header->type == RecordType::DELTA;
+      nodes[node_index].record_offset = m_buffer.offset_of(reinterpret_cast<const uint8_t *>(record_header));
+      ++node_index;
+    }
+  }
+
+  IndexSnapshotHeader * snapshot_header = reinterpret_cast<IndexSnapshotHeader *>(snapshot);
+  snapshot_header->committed_seq = m_header->committed_seq;
+  snapshot_header->hash_table_size = m_hash_table.size();
+  snapshot_header->num_nodes = node_index;
+  snapshot_header->checksum = snapshot_checksum(snapshot_header);
+  snapshot_header->magic = INDEX_SNAPSHOT_MAGIC;
+  m_buffer.mark_dirty(snapshot, snapshot_size);
+
+  // the snapshot is complete, and on disk, before the table header points to it. without durability a power loss can
+  // write back the header without the snapshot, which its checksum catches
+  if (m_durability != Durability::NONE) {
+    m_buffer.sync();
+  }
+  __atomic_store_n(&m_header->index_snapshot_offset, m_buffer.offset_of(snapshot), __ATOMIC_RELEASE);
+  m_buffer.mark_dirty(m_header, sizeof(TableHeader));
+  return true;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::~BasicConcurrentHashTable()
+{
+  if (m_recoverer.joinable()) {
+    m_recoverer.join();
+  }
+  {
+    std::unique_lock<std::mutex> flusher_lock(m_flusher_mutex);
+    m_stop_flusher = true;
+  }
+  m_flusher_wakeup.notify_all();
+  if (m_flusher.joinable()) {
+    m_flusher.join();
+  }
+  m_closing.store(true, std::memory_order_relaxed);
+  if (!m_handed_off && m_durability != Durability::VOLATILE) {
+    save_index();
+    if (m_durability == Durability::LOG) {
+      std::unique_lock<std::mutex> write_lock(m_write_mutex);
+      checkpoint_locked();
+    } else if (m_durability != Durability::NONE) {
+      m_buffer.sync();
+    }
+  }
+
+  // let go of the records while m_closing is set, so that they aren't freed
+  m_bucket_storage.clear();
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::free_record(const uint8_t * record)
+{
+  // held across the free, so that a handoff can't send the buffer away in the middle of one
+  std::unique_lock<std::mutex> handoff_lock(m_handoff_mutex);
+  if (m_closing.load(std::memory_order_relaxed)) {
+    return;
+  }
+  if (m_handing_off) {
+    m_deferred_frees.push_back(record);
+    return;
+  }
+  m_buffer.free(record);
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::checkpoint_to(const std::string & filename)
+{
+  wait_until_recovered();
+  return m_buffer.copy_to(filename.c_str(), [this]() { return std::unique_lock<std::mutex>(m_write_mutex); });
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::set_residency(const Residency & residency)
+{
+  m_buffer.set_residency(residency);
+  const size_t index_size = m_hash_table.size() * sizeof(m_hash_table[0]);
+  if (!residency.lock_metadata) {
+    munlock(m_hash_table.data(), index_size);
+  } else if (mlock(m_hash_table.data(), index_size) != 0) {
+    int err = errno;
+    std::cerr << "[WARN] locking the index in memory failed: " << strerror(err) << '\n';
+  }
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::backup_to(const std::string & directory)
+{
+  wait_until_recovered();
+  return m_buffer.backup_to(directory.c_str(), [this]() { return std::unique_lock<std::mutex>(m_write_mutex); });
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::hand_off(const int socket_fd)
+{
+  wait_until_recovered();
+  {
+    std::unique_lock<std::mutex> flusher_lock(m_flusher_mutex);
+    m_stop_flusher = true;
+  }
+  m_flusher_wakeup.notify_all();
+  if (m_flusher.joinable()) {
+    m_flusher.join();
+  }
+
+  std::unique_lock<std::mutex> write_lock(m_write_mutex);
+  std::unique_lock<std::mutex> log_lock = lock_log();
+  {
+    std::unique_lock<std::mutex> handoff_lock(m_handoff_mutex);
+    m_handing_off = true;
+  }
+  const bool index_saved = save_index();
+  // the successor only knows to write back the pages it dirties itself
+  if (m_durability != Durability::NONE) {
+    m_buffer.sync();
+  }
+
+  // a hole this process punched later could land on a record the successor wrote meanwhile
+  m_buffer.pause_background_work();
+
+  std::vector<int> fds = {m_buffer.fd()};
+  if (m_log) {
+    fds.push_back(m_log->fd());
+  }
+  m_handed_off = send_fds(socket_fd, fds);
+  std::vector<const uint8_t *> deferred_frees;
+  {
+    std::unique_lock<std::mutex> handoff_lock(m_handoff_mutex);
+    m_handing_off = false;
+    m_closing.store(m_handed_off, std::memory_order_relaxed);
+    deferred_frees.swap(m_deferred_frees);
+  }
+  if (!m_handed_off) {
+    // carry on as before, without the snapshot, which would be out of date by the next shutdown
+    if (index_saved) {
+      uint8_t * snapshot = m_buffer.pointer_at(m_header->index_snapshot_offset);
+      m_header->index_snapshot_offset = NULL_OFFSET;
+      m_buffer.mark_dirty(m_header, sizeof(TableHeader));
+      m_buffer.free(snapshot);
+    }
+    for (const uint8_t * record : deferred_frees) {
+      m_buffer.free(record);
+    }
+    m_buffer.resume_background_work();
+    m_stop_flusher = false;
+    if (m_durability == Durability::PERIODIC) {
+      m_flusher = std::thread(&BasicConcurrentHashTable::flush_periodically, this);
+    }
+  }
+  return m_handed_off;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::unique_ptr<BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>> BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::take_over(const int socket_fd, const Options & options)
+{
+  const std::vector<int> fds = receive_fds(socket_fd);
+  if (fds.empty()) {
+    return nullptr;
+  }
+  std::cout << "[INFO] taking over the store handed off by another process\n";
+  // the constructor is private, so not std::make_unique()
+  return std::unique_ptr<BasicConcurrentHashTable>(new BasicConcurrentHashTable(options, fds[0], fds.size() > 1 ? fds[1] : -1));
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::unique_ptr<BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>> BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::take_over(const int socket_fd, const Durability durability)
+{
+  Options options;
+  options.durability = durability;
+  return take_over(socket_fd, options);
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::put(const std::string & key, const std::string & value)
+{
+  std::unique_lock<std::mutex> write_lock(m_write_mutex);
+  const bool success = put_locked(key, value, find_bucket_with_key(key));
+  const bool durable = make_durable(write_lock);
+  return success && durable;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::put_if_version(const std::string & key, const std::string & value, const uint64_t expected_version)
+{
+  std::unique_lock<std::mutex> write_lock(m_write_mutex);
+
+  std::pair<Bucket *, size_t> result = find_bucket_with_key(key);
+  const uint64_t version = (result.first == nullptr) ? 0 : result.first->key_value_pair.version();
+  if (version != expected_version) {
+    return false;
+  }
+  const bool success = put_locked(key, value, result);
+  const bool durable = make_durable(write_lock);
+  return success && durable;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::put_locked(const std::string & key,
+                                                                                          const std::string & value,
+                                                                                          const std::pair<Bucket *, size_t> & result,
+                                                                                          const uint64_t logged_version)
+{
+  const uint64_t version = (logged_version != 0) ? logged_version
+                           : (result.first == nullptr) ? 1 : result.first->key_value_pair.version() + 1;
+
+  // a value of the same size as the existing one can be written over it, under the record's sequence lock
+  if (m_overwrite_in_place && result.first != nullptr && overwrite_locked(key, value, version, result.first)) {
+    return true;
+  }
+
+  // otherwise we choose to allocate a new block of data, even if the key already exists, so that readers can
+  // keep using the old block without locking until they are done with it
+  const size_t allocation_size = sizeof(RecordHeader) + key.length() + 1 + value.length() + 1;
+  uint8_t * data_buffer = m_buffer.alloc(allocation_size);
+  if (data_buffer == nullptr) {
+    return false;
+  }
+  if (!append_log_locked({{WriteAheadLog::EntryType::PUT, version, key, value}})) {
+    m_buffer.free(data_buffer);
+    return false;
+  }
+
+  const uint64_t commit_seq = begin_commit();
+  KeyValuePair::write(reinterpret_cast<char *>(data_buffer), commit_seq, version, key, value);
+  m_buffer.mark_dirty(data_buffer, allocation_size);
+  install_locked(data_buffer, commit_seq, result);
+  checkpoint_if_full_locked();
+
+  return true;
+}
+
+// readers copy the value between two reads of overwrite_seq, and retry if it was odd or changed in between
+// this doesn't allocate or free, so there's no churn or fragmentation in the buffer for fixed size values
+// the overwrite isn't atomic with respect to a crash, a record found half overwritten on restart is discarded, so the
+// overwrite is logged before it starts, and the log isn't checkpointed until it's done
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::overwrite_locked(const std::string & key,
+                                                                                                const std::string & value,
+                                                                                                const uint64_t version,
+                                                                                                Bucket * bucket)
+{
+  RecordHeader * record_header = const_cast<RecordHeader *>(bucket->key_value_pair.header());
+  if (record_header->type != RecordType::VALUE) {
+    return false;
+  }
+  const char * record_key = reinterpret_cast<const char *>(record_header) + sizeof(RecordHeader);
+  char * value_data = const_cast<char *>(strchr(record_key, '\0') + 1);
+  if (strlen(value_data) != value.length()) {
+    return false;
+  }
+
+  if (!append_log_locked({{WriteAheadLog::EntryType::PUT, version, key, value}})) {
+    return false;
+  }
+  const uint64_t overwrite_seq = record_header->overwrite_seq;
+  __atomic_store_n(&record_header->overwrite_seq, overwrite_seq + 1, __ATOMIC_RELAXED);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(value_data, value.c_str(), value.length());
+  record_header->version = version;
+  KeyValuePair::seal(record_header);
+  __atomic_store_n(&record_header->overwrite_seq, overwrite_seq + 2, __ATOMIC_RELEASE);
+  m_buffer.mark_dirty(record_header, value_data + value.length() - reinterpret_cast<const char *>(record_header));
+  checkpoint_if_full_locked();
+
+  return true;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::put_counter_locked(const std::string & key,
+                                                                                                  const int64_t value,
+                                                                                                  const std::pair<Bucket *, size_t> & result)
+{
+  const size_t allocation_size = sizeof(RecordHeader) + KeyValuePair::counter_offset(key.length()) + sizeof(int64_t);
+  uint8_t * data_buffer = m_buffer.alloc(allocation_size);
+  if (data_buffer == nullptr) {
+    return false;
+  }
+  const uint64_t version = (result.first == nullptr) ? 1 : result.first->key_value_pair.version() + 1;
+  if (!append_log_locked({{WriteAheadLog::EntryType::COUNTER, version, key, std::string_view(reinterpret_cast<const char *>(&value), sizeof(value))}})) {
+    m_buffer.free(data_buffer);
+    return false;
+  }
+
+  const uint64_t commit_seq = begin_commit();
+  KeyValuePair::write_counter(reinterpret_cast<char *>(data_buffer), commit_seq, version, key, value);
+  m_buffer.mark_dirty(data_buffer, allocation_size);
+  install_locked(data_buffer, commit_seq, result);
+  checkpoint_if_full_locked();
+
+  return true;
+}
+
+// commits the single record staged in data_buffer, replacing the record in the bucket found for its key
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::install_locked(uint8_t * data_buffer,
+                                                                                              const uint64_t commit_seq,
+                                                                                              const std::pair<Bucket *, size_t> & result)
+{
+  if (result.first != nullptr) {
+    result.first->key_value_pair.supersede(commit_seq);
+    m_buffer.mark_dirty(result.first->key_value_pair.header(), sizeof(RecordHeader));
+  }
+  end_commit(commit_seq);
+
+  // a single bucket is updated atomically, so there's no need to go through begin_publish() and end_publish()
+  Bucket * bucket = (result.first == nullptr) ? get_new_bucket() : result.first;
+  bucket->key_value_pair.set(reinterpret_cast<char *>(data_buffer), BufferFreer(this));
+
+  if (result.first == nullptr) {
+    store_bucket(bucket, result.second);
+  }
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+size_t BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::put_batch(const std::vector<std::pair<std::string, std::string>> & key_value_pairs,
+                                                                                           const BatchMode mode)
+{
+  std::unique_lock<std::mutex> write_lock(m_write_mutex);
+
+  std::vector<size_t> allocation_sizes; allocation_sizes.reserve(key_value_pairs.size());
+  for (const auto & key_value_pair : key_value_pairs) {
+    allocation_sizes.push_back(sizeof(RecordHeader) + key_value_pair.first.length() + 1 + key_value_pair.second.length() + 1);
+  }
+  const std::vector<uint8_t *> data_buffers = m_buffer.alloc_batch(allocation_sizes, mode == BatchMode::ALL_OR_NOTHING);
+
+  // stage every record under the same commit
+  const uint64_t commit_seq = begin_commit();
+  std::unordered_map<std::string_view, size_t> latest_index;  // of the pairs with the same key, the one that's kept
+  size_t num_written = 0;
+  for (size_t i = 0; i < key_value_pairs.size(); ++i) {
+    if (data_buffers[i] == nullptr) {
+      continue;
+    }
+
+    const std::string & key = key_value_pairs[i].first;
+    uint64_t version = 1;
+    auto latest = latest_index.find(key);
+    if (latest != latest_index.end()) {
+      version = reinterpret_cast<const RecordHeader *>(data_buffers[latest->second])->version + 1;
+    } else {
+      std::pair<Bucket *, size_t> result = find_bucket_with_key(key);
+      if (result.first != nullptr) {
+        version = result.first->key_value_pair.version() + 1;
+      }
+    }
+    KeyValuePair::write(reinterpret_cast<char *>(data_buffers[i]), commit_seq, version, key, key_value_pairs[i].second);
+    m_buffer.mark_dirty(data_buffers[i], allocation_sizes[i]);
+    latest_index[key] = i;
+    ++num_written;
+  }
+  if (num_written == 0) {
+    return 0;
+  }
+
+  // the staged records are only committed once the batch is logged, otherwise they're freed as if never written
+  std::vector<WriteAheadLog::Entry> log_entries;
+  if (m_log) {
+    log_entries.reserve(latest_index.size());
+    for (const auto & key_and_index : latest_index) {
+      const size_t i = key_and_index.second;
+      const uint64_t version = reinterpret_cast<const RecordHeader *>(data_buffers[i])->version;
+      log_entries.push_back({WriteAheadLog::EntryType::PUT, version, key_value_pairs[i].first, key_value_pairs[i].second});
+    }
+  }
+  if (!append_log_locked(log_entries)) {
+    for (const uint8_t * data_buffer : data_buffers) {
+      if (data_buffer != nullptr) {
+        m_buffer.free(data_buffer);
+      }
+    }
+    return 0;
+  }
+
+  std::vector<const uint8_t *> overwritten_records;
+  for (size_t i = 0; i < key_value_pairs.size(); ++i) {
+    if (data_buffers[i] == nullptr) {
+      continue;
+    }
+    if (latest_index[key_value_pairs[i].first] != i) {
+      reinterpret_cast<RecordHeader *>(data_buffers[i])->superseded_seq = commit_seq;
+      m_buffer.mark_dirty(data_buffers[i], sizeof(RecordHeader));
+      overwritten_records.push_back(data_buffers[i]);
+      continue;
+    }
+    std::pair<Bucket *, size_t> result = find_bucket_with_key(key_value_pairs[i].first);
+    if (result.first != nullptr) {
+      result.first->key_value_pair.supersede(commit_seq);
+      m_buffer.mark_dirty(result.first->key_value_pair.header(), sizeof(RecordHeader));
+    }
+  }
+  end_commit(commit_seq);
+
+  begin_publish();
+  for (const auto & key_and_index : latest_index) {
+    const size_t i = key_and_index.second;
+    std::pair<Bucket *, size_t> result = find_bucket_with_key(key_value_pairs[i].first);
+    Bucket * bucket = (result.first == nullptr) ? get_new_bucket() : result.first;
+    bucket->key_value_pair.set(reinterpret_cast<char *>(data_buffers[i]), BufferFreer(this));
+
+    if (result.first == nullptr) {
+      store_bucket(bucket, result.second);
+    }
+  }
+  end_publish();
+  checkpoint_if_full_locked();
+
+  for (const uint8_t * record : overwritten_records) {
+    m_buffer.free(record);
+  }
+
+  return make_durable(write_lock) ? num_written : 0;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::commit(const WriteBatch & batch)
+{
+  return put_batch(batch.m_key_value_pairs, BatchMode::ALL_OR_NOTHING) == batch.size();
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::merge(const std::string & key, const std::string & delta)
+{
+  std::unique_lock<std::mutex> write_lock(m_write_mutex);
+  const bool success = merge_locked(key, delta);
+  const bool durable = make_durable(write_lock);
+  return success && durable;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::merge_locked(const std::string & key, const std::string & delta)
+{
+  std::pair<Bucket *, size_t> result = find_bucket_with_key(key);
+  if (result.first == nullptr) {
+    const std::string value = m_merge_operator ? m_merge_operator(std::string(), delta) : delta;
+    return put_locked(key, value, result);
+  }
+
+  // fold the chain once it gets long enough that reads would be slowed down by applying the deltas
+  const std::pair<RecordHandle, const char *> prev_record = result.first->key_value_pair.get();
+  const RecordHeader * prev_record_header = KeyValuePair::header_of(prev_record.first.get());
+  if (prev_record_header->chain_length + 1 >= MAX_MERGE_CHAIN_LENGTH) {
+    std::string value = read_value(prev_record.first.get());
+    if (m_merge_operator) {
+      value = m_merge_operator(value, delta);
+    } else {
+      value += delta;
+    }
+    return put_locked(key, value, result);
+  }
+
+  const size_t allocation_size = sizeof(RecordHeader) + key.length() + 1 + delta.length() + 1;
+  uint8_t * data_buffer = m_buffer.alloc(allocation_size);
+  if (data_buffer == nullptr) {
+    return false;
+  }
+  if (!append_log_locked({{WriteAheadLog::EntryType::MERGE, prev_record_header->version + 1, key, delta}})) {
+    m_buffer.free(data_buffer);
+    return false;
+  }
+
+  const uint64_t commit_seq = begin_commit();
+  const FileByteOffset prev_record_offset = m_buffer.offset_of(reinterpret_cast<const uint8_t *>(prev_record_header));
+  KeyValuePair::write_delta(reinterpret_cast<char *>(data_buffer), commit_seq, prev_record_header, prev_record_offset, key, delta);
+  m_buffer.mark_dirty(data_buffer, allocation_size);
+  result.first->key_value_pair.supersede(commit_seq);
+  m_buffer.mark_dirty(prev_record_header, sizeof(RecordHeader));
+  end_commit(commit_seq);
+
+  result.first->key_value_pair.set(reinterpret_cast<char *>(data_buffer), BufferFreer(this, prev_record.first));
+  checkpoint_if_full_locked();
+
+  return true;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::fetch_add(const std::string & key, const int64_t delta, int64_t & previous_value)
+{
+  wait_until_indexed(key);
+  while (true) {
+    std::pair<Bucket *, size_t> result = find_bucket_with_key(key);
+    if (result.first != nullptr) {
+      // the record stays alive while it's held, an update racing with a put() of the same key is ordered before it
+      const std::pair<RecordHandle, const char *> record = result.first->key_value_pair.get();
+      if (KeyValuePair::header_of(record.first.get())->type != RecordType::COUNTER) {
+        return false;
+      }
+      std::unique_lock<std::mutex> log_lock = lock_log();
+      int64_t * counter = KeyValuePair::counter_of(record.first.get());
+      previous_value = __atomic_fetch_add(counter, delta, __ATOMIC_ACQ_REL);
+      m_buffer.mark_dirty(counter, sizeof(int64_t));
+      return make_counter_durable(log_lock, record.first.get(), previous_value + delta);
+    }
+
+    // the first update of a counter creates its record
+    std::unique_lock<std::mutex> write_lock(m_write_mutex);
+    result = find_bucket_with_key(key);
+    if (result.first == nullptr) {
+      previous_value = 0;
+      const bool success = put_counter_locked(key, delta, result);
+      const bool durable = make_durable(write_lock);
+      return success && durable;
+    }
+    // lost the race to create it, update the one that was created instead
+  }
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::compare_exchange(const std::string & key, int64_t & expected_value, const int64_t desired_value)
+{
+  wait_until_indexed(key);
+  while (true) {
+    std::pair<Bucket *, size_t> result = find_bucket_with_key(key);
+    if (result.first != nullptr) {
+      const std::pair<RecordHandle, const char *> record = result.first->key_value_pair.get();
+      if (KeyValuePair::header_of(record.first.get())->type != RecordType::COUNTER) {
+        return false;
+      }
+      std::unique_lock<std::mutex> log_lock = lock_log();
+      int64_t * counter = KeyValuePair::counter_of(record.first.get());
+      if (!__atomic_compare_exchange_n(counter, &expected_value, desired_value, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return false;
+      }
+      m_buffer.mark_dirty(counter, sizeof(int64_t));
+      return make_counter_durable(log_lock, record.first.get(), desired_value);
+    }
+
+    std::unique_lock<std::mutex> write_lock(m_write_mutex);
+    result = find_bucket_with_key(key);
+    if (result.first == nullptr) {
+      if (expected_value != 0) {
+        expected_value = 0;
+        return false;
+      }
+      const bool success = put_counter_locked(key, desired_value, result);
+      const bool durable = make_durable(write_lock);
+      return success && durable;
+    }
+  }
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::string BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::get(const std::string & key)
+{
+  wait_until_indexed(key);
+  std::pair<Bucket *, size_t> result = find_bucket_with_key(key);
+  if (result.first == nullptr) {
+    return std::string();
+  }
+  return read_value(result.first->key_value_pair.get().first.get());
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::pair<std::string, uint64_t> BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::get_versioned(const std::string & key)
+{
+  wait_until_indexed(key);
+  std::pair<Bucket *, size_t> result = find_bucket_with_key(key);
+  if (result.first == nullptr) {
+    return std::make_pair(std::string(), 0);
+  }
+  const std::pair<RecordHandle, const char *> key_value_pair = result.first->key_value_pair.get();
+  uint64_t version;
+  std::string value = read_value(key_value_pair.first.get(), &version);
+  return std::make_pair(std::move(value), version);
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::vector<std::string> BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::multi_get(const std::vector<std::string> & keys)
+{
+  std::vector<std::string> results(keys.size());
+  for (const std::string & key : keys) {
+    wait_until_indexed(key);
+  }
+
+  // hash everything up front, and start fetching the directory slots
+  std::vector<size_t> hash_table_indices(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    hash_table_indices[i] = m_hasher(keys[i]) % m_hash_table.size();
+    __builtin_prefetch(&m_hash_table[hash_table_indices[i]]);
+  }
+
+  // retry if a commit was published while looking up, so that only whole commits are observed
+  uint64_t publish_seq;
+  do {
+    publish_seq = m_publish_seq.load(std::memory_order_acquire);
+    if (publish_seq % 2 != 0) {
+      std::this_thread::yield();
+      continue;
+    }
+    std::fill(results.begin(), results.end(), std::string());
+    lookup_interleaved(keys, hash_table_indices, results);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while (publish_seq % 2 != 0 || m_publish_seq.load(std::memory_order_relaxed) != publish_seq);
+
+  return results;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::lookup_interleaved(const std::vector<std::string> & keys,
+                                                                                                  const std::vector<size_t> & hash_table_indices,
+                                                                                                  std::vector<std::string> & results) const
+{
+  // state of one in-flight lookup, advanced one step (one potential cache miss) at a time
+  struct Lookup {
+    enum class Stage { LOAD_BUCKET, LOAD_HANDLE, LOAD_RECORD, COMPARE_KEY, DONE };
+    Stage stage;
+    size_t key_index;
+    size_t hash_table_index;
+    Bucket * bucket;
+    std::pair<RecordHandle, const char *> record;
+  };
+
+  std::array<Lookup, MULTI_GET_GROUP_SIZE> lookups;
+  size_t next_key_index = 0;
+  size_t num_in_flight = 0;
+  for (Lookup & lookup : lookups) {
+    if (next_key_index < keys.size()) {
+      lookup.stage = Lookup::Stage::LOAD_BUCKET;
+      lookup.key_index = next_key_index;
+      lookup.hash_table_index = hash_table_indices[next_key_index];
+      ++next_key_index;
+      ++num_in_flight;
+    } else {
+      lookup.stage = Lookup::Stage::DONE;
+    }
+  }
+
+  while (num_in_flight > 0) {
+    for (Lookup & lookup : lookups) {
+      switch (lookup.stage) {
+        case Lookup::Stage::LOAD_BUCKET:
+          lookup.bucket = m_hash_table[lookup.hash_table_index].load(std::memory_order_acquire);
+          if (lookup.bucket != nullptr) {
+            __builtin_prefetch(lookup.bucket);
+            lookup.stage = Lookup::Stage::LOAD_HANDLE;
+          } else {
+            lookup.stage = Lookup::Stage::DONE;
+          }
+          break;
+
+        case Lookup::Stage::LOAD_HANDLE:
+          // the reference count that taking the record increments, and the record's key, which finding the value reads
+          lookup.bucket->key_value_pair.prefetch();
+          lookup.stage = Lookup::Stage::LOAD_RECORD;
+          break;
+
+        case Lookup::Stage::LOAD_RECORD:
+          lookup.record = lookup.bucket->key_value_pair.get();
+          __builtin_prefetch(lookup.bucket->next_bucket);
+          lookup.stage = Lookup::Stage::COMPARE_KEY;
+          break;
+
+        case Lookup::Stage::COMPARE_KEY:
+          if (keys[lookup.key_index] == lookup.record.first.get()) {
+            results[lookup.key_index] = read_value(lookup.record.first.get());
+            lookup.stage = Lookup::Stage::DONE;
+          } else if (lookup.bucket->next_bucket != nullptr) {
+            lookup.bucket = lookup.bucket->next_bucket;
+            lookup.stage = Lookup::Stage::LOAD_HANDLE;
+          } else {
+            lookup.stage = Lookup::Stage::DONE;
+          }
+          lookup.record.first.reset();
+          break;
+
+        case Lookup::Stage::DONE:
+          continue;
+      }
+
+      // refill the slot of a finished lookup with the next key
+      if (lookup.stage == Lookup::Stage::DONE) {
+        if (next_key_index < keys.size()) {
+          lookup.stage = Lookup::Stage::LOAD_BUCKET;
+          lookup.key_index = next_key_index;
+          lookup.hash_table_index = hash_table_indices[next_key_index];
+          ++next_key_index;
+        } else {
+          --num_in_flight;
+        }
+      }
+    }
+  }
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::pair<typename BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::Bucket *, size_t>
+BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::find_bucket_with_key(const std::string & key) const
+{
+  size_t hash = m_hasher(key);
+  size_t hash_table_index = hash % m_hash_table.size();
+
+  Bucket * curr_bucket = m_hash_table[hash_table_index].load(std::memory_order_acquire);
+  if (curr_bucket == nullptr) {
+    return std::make_pair(nullptr, hash_table_index);
+  }
+
+  while (key != curr_bucket->key_value_pair.get().first.get()) {
+    curr_bucket = curr_bucket->next_bucket;
+    if (curr_bucket == nullptr) {
+      break;
+    }
+  }
+
+  return std::make_pair(curr_bucket, hash_table_index);
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::string BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::read_value(const char * key, uint64_t * version) const
+{
+  const RecordHeader * record_header = KeyValuePair::header_of(key);
+  m_buffer.prepare_read(record_header, sizeof(RecordHeader) + record_header->data_length);
+  if (record_header->type == RecordType::VALUE) {
+    // the only kind of record that can be overwritten in place, see overwrite_locked()
+    const char * value_data = strchr(key, '\0') + 1;
+    const size_t value_length = strlen(value_data);  // the length doesn't change with an overwrite
+    std::string value(value_length, '\0');
+    uint64_t overwrite_seq;
+    bool intact;
+    do {
+      overwrite_seq = __atomic_load_n(&record_header->overwrite_seq, __ATOMIC_ACQUIRE);
+      if (overwrite_seq % 2 != 0) {
+        std::this_thread::yield();
+        continue;
+      }
+      memcpy(&value[0], value_data, value_length);
+      if (version != nullptr) {
+        *version = record_header->version;
+      }
+      // an overwrite in between can fail the check, and is caught below
+      intact = !m_verify_reads || record_intact(record_header);
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while (overwrite_seq % 2 != 0 || __atomic_load_n(&record_header->overwrite_seq, __ATOMIC_RELAXED) != overwrite_seq);
+    if (!intact) {
+      return checksum_failure(record_header, version);
+    }
+    return value;
+  }
+
+  if (m_verify_reads && !record_intact(record_header)) {
+    return checksum_failure(record_header, version);
+  }
+  if (version != nullptr) {
+    *version = record_header->version;
+  }
+  if (record_header->type == RecordType::COUNTER) {
+    return std::to_string(__atomic_load_n(KeyValuePair::counter_of(key), __ATOMIC_ACQUIRE));
+  }
+
+  // walk back to the whole value, the records along the way are kept alive by the first one
+  std::vector<const char *> deltas;
+  while (record_header->type == RecordType::DELTA) {
+    deltas.push_back(strchr(key, '\0') + 1);
+    record_header = reinterpret_cast<const RecordHeader *>(m_buffer.pointer_at(record_header->prev_record_offset));
+    key = reinterpret_cast<const char *>(record_header) + sizeof(RecordHeader);
+    if (m_verify_reads && !record_intact(record_header)) {
+      return checksum_failure(record_header, version);
+    }
+  }
+
+  std::string value = (record_header->type == RecordType::COUNTER)
+                      ? std::to_string(__atomic_load_n(KeyValuePair::counter_of(key), __ATOMIC_ACQUIRE))
+                      : std::string(strchr(key, '\0') + 1);
+  for (auto iter = deltas.rbegin(); iter != deltas.rend(); ++iter) {
+    if (m_merge_operator) {
+      value = m_merge_operator(value, *iter);
+    } else {
+      value += *iter;
+    }
+  }
+  return value;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::string BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::checksum_failure(const RecordHeader * record_header, uint64_t * version) const
+{
+  m_num_read_checksum_failures.fetch_add(1, std::memory_order_relaxed);
+  std::cerr << "[ERROR] the record at offset " << m_buffer.offset_of(reinterpret_cast<const uint8_t *>(record_header))
+            << " failed its checksum\n";
+  if (version != nullptr) {
+    *version = 0;
+  }
+  return std::string();
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+typename BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::Bucket * BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::get_new_bucket()
+{
+  m_bucket_storage.emplace_back();
+  return &m_bucket_storage.back();
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::store_bucket(Bucket * bucket, const size_t hash_table_index)
+{
+  bucket->next_bucket = m_hash_table[hash_table_index].load(std::memory_order_relaxed);
+  m_hash_table[hash_table_index].store(bucket, std::memory_order_release);
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::set_recovered_partitions(const size_t num_partitions)
+{
+  {
+    std::unique_lock<std::mutex> recovery_lock(m_recovery_mutex);
+    m_num_recovered_partitions.store(num_partitions, std::memory_order_release);
+  }
+  m_recovery_progress.notify_all();
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::wait_until_indexed(const std::string & key) const
+{
+  if (m_num_recovered_partitions.load(std::memory_order_acquire) == NUM_RECOVERY_PARTITIONS) {
+    return;
+  }
+  const size_t partition = recovery_partition_of(m_hasher(key) % m_hash_table.size());
+  std::unique_lock<std::mutex> recovery_lock(m_recovery_mutex);
+  m_recovery_progress.wait(recovery_lock, [this, partition]() {
+    return m_num_recovered_partitions.load(std::memory_order_acquire) > partition;
+  });
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::wait_until_recovered() const
+{
+  if (m_num_recovered_partitions.load(std::memory_order_acquire) == NUM_RECOVERY_PARTITIONS) {
+    return;
+  }
+  std::unique_lock<std::mutex> recovery_lock(m_recovery_mutex);
+  m_recovery_progress.wait(recovery_lock, [this]() {
+    return m_num_recovered_partitions.load(std::memory_order_acquire) == NUM_RECOVERY_PARTITIONS;
+  });
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::end_commit(const uint64_t commit_seq)
+{
+  // everything the commit wrote to the buffer must land before the commit point
+  __atomic_store_n(&m_header->committed_seq, commit_seq, __ATOMIC_RELEASE);
+  m_buffer.mark_dirty(m_header, sizeof(TableHeader));
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::append_log_locked(const std::vector<WriteAheadLog::Entry> & entries)
+{
+  if (!m_log) {
+    return true;
+  }
+  std::unique_lock<std::mutex> log_lock = m_log->lock();
+  const uint64_t lsn = m_log->append_locked(entries);
+  if (lsn == 0) {
+    return false;
+  }
+  m_log_lsn = lsn;
+  return true;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::checkpoint_if_full_locked()
+{
+  if (!m_log) {
+    return;
+  }
+  std::unique_lock<std::mutex> log_lock = m_log->lock();
+  const bool full = m_log->size() > LOG_CHECKPOINT_SIZE;
+  log_lock.unlock();
+
+  if (full) {
+    checkpoint_locked();
+  }
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::make_durable(std::unique_lock<std::mutex> & write_lock)
+{
+  if (m_durability == Durability::LOG) {
+    const uint64_t lsn = m_log_lsn;
+    write_lock.unlock();
+    return m_log->sync(lsn);
+  } else if (m_durability == Durability::SYNC) {
+    // writers that arrive while a sync is in progress wait for it, and then share the next one
+    write_lock.unlock();
+    return m_buffer.sync();
+  }
+  return true;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::make_counter_durable(std::unique_lock<std::mutex> & log_lock, const char * key, const int64_t value)
+{
+  if (m_durability == Durability::SYNC) {
+    return m_buffer.sync();
+  }
+  if (m_durability != Durability::LOG) {
+    return true;
+  }
+  const uint64_t lsn = m_log->append_locked({{WriteAheadLog::EntryType::COUNTER,
+                                              KeyValuePair::header_of(key)->version,
+                                              key,
+                                              std::string_view(reinterpret_cast<const char *>(&value), sizeof(value))}});
+  log_lock.unlock();
+  return lsn != 0 && m_log->sync(lsn);
+}
+
+// the log only needs to hold what the buffer file might not have yet
+// must be called with m_write_mutex held, the log's lock also keeps counters from being updated meanwhile
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::checkpoint_locked()
+{
+  std::unique_lock<std::mutex> log_lock = m_log->lock();
+  if (m_buffer.sync()) {
+    m_log->truncate();
+  }
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::flush_periodically()
+{
+  std::unique_lock<std::mutex> flusher_lock(m_flusher_mutex);
+  while (!m_stop_flusher) {
+    m_flusher_wakeup.wait_for(flusher_lock, FLUSH_INTERVAL);
+    flusher_lock.unlock();
+    m_buffer.sync();
+    flusher_lock.lock();
+  }
+}
+
+// the buffer file already has a write if the key is at the logged version or past it, otherwise it's redone at the
+// logged version (counter updates don't change the version, and are logged with the value the counter ended up with)
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+bool BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::replay_log_entry(const WriteAheadLog::Entry & entry)
+{
+  const std::string key(entry.key);
+  std::pair<Bucket *, size_t> result = find_bucket_with_key(key);
+  const uint64_t version = (result.first == nullptr) ? 0 : result.first->key_value_pair.version();
+
+  switch (entry.type) {
+    case WriteAheadLog::EntryType::PUT:
+      return version < entry.version && put_locked(key, std::string(entry.value), result, entry.version);
+
+    case WriteAheadLog::EntryType::MERGE:
+      return version < entry.version && merge_locked(key, std::string(entry.value));
+
+    case WriteAheadLog::EntryType::COUNTER: {
+      int64_t value;
+      memcpy(&value, entry.value.data(), sizeof(value));
+      if (version == entry.version && result.first->key_value_pair.header()->type == RecordType::COUNTER) {
+        int64_t * counter = KeyValuePair::counter_of(result.first->key_value_pair.get().first.get());
+        const bool redone = __atomic_exchange_n(counter, value, __ATOMIC_ACQ_REL) != value;
+        m_buffer.mark_dirty(counter, sizeof(int64_t));
+        return redone;
+      }
+      return version < entry.version && put_counter_locked(key, value, result);
+    }
+  }
+  return false;
+}
+
+// information to be stored in record_data: RecordHeader + <key> + '\0' + <value> + '\0'
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::KeyValuePair::write(char * record_data,
+                                                                                                   const uint64_t commit_seq,
+                                                                                                   const uint64_t version,
+                                                                                                   const std::string & key,
+                                                                                                   const std::string & value)
+{
+  fill(record_data, commit_seq, version, key, value);
+  seal(reinterpret_cast<RecordHeader *>(record_data));
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::KeyValuePair::fill(char * record_data,
+                                                                                                  const uint64_t commit_seq,
+                                                                                                  const uint64_t version,
+                                                                                                  const std::string & key,
+                                                                                                  const std::string & value)
+{
+  RecordHeader * record_header = reinterpret_cast<RecordHeader *>(record_data);
+  record_header->commit_seq = commit_seq;
+  record_header->superseded_seq = 0;
+  record_header->version = version;
+  record_header->type = RecordType::VALUE;
+  record_header->chain_length = 0;
+  record_header->prev_record_offset = NULL_OFFSET;
+  record_header->overwrite_seq = 0;
+  record_header->data_length = key.length() + 1 + value.length() + 1;
+
+  char * key_data = record_data + sizeof(RecordHeader);
+  strncpy(key_data, key.c_str(), key.length() + 1);
+
+  char * key_data_end = strchr(key_data, '\0');
+  assert(key_data_end != nullptr);
+
+  char * value_data = key_data_end + 1;
+  strncpy(value_data, value.c_str(), value.length() + 1);
+}
+
+// information to be stored in record_data: RecordHeader + <key> + '\0' + <delta> + '\0'
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::KeyValuePair::write_delta(char * record_data,
+                                                                                                         const uint64_t commit_seq,
+                                                                                                         const RecordHeader * prev_record_header,
+                                                                                                         const FileByteOffset prev_record_offset,
+                                                                                                         const std::string & key,
+                                                                                                         const std::string & delta)
+{
+  fill(record_data, commit_seq, prev_record_header->version + 1, key, delta);
+
+  RecordHeader * record_header = reinterpret_cast<RecordHeader *>(record_data);
+  record_header->type = RecordType::DELTA;
+  record_header->chain_length = prev_record_header->chain_length + 1;
+  record_header->prev_record_offset = prev_record_offset;
+  seal(record_header);
+}
+
+// information to be stored in record_data: RecordHeader + <key> + '\0' + <padding> + <int64_t value>
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::KeyValuePair::write_counter(char * record_data,
+                                                                                                           const uint64_t commit_seq,
+                                                                                                           const uint64_t version,
+                                                                                                           const std::string & key,
+                                                                                                           const int64_t value)
+{
+  fill(record_data, commit_seq, version, key, std::string());
+
+  RecordHeader * record_header = reinterpret_cast<RecordHeader *>(record_data);
+  record_header->type = RecordType::COUNTER;
+  record_header->data_length = key.length() + 1;
+  *counter_of(record_data + sizeof(RecordHeader)) = value;
+  seal(record_header);
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+uint32_t BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::KeyValuePair::checksum_of(const RecordHeader * record_header)
+{
+  uint32_t checksum = crc32c(&record_header->commit_seq, sizeof(record_header->commit_seq));
+  checksum = crc32c(&record_header->version, sizeof(record_header->version), checksum);
+  checksum = crc32c(&record_header->type, sizeof(record_header->type), checksum);
+  checksum = crc32c(&record_header->chain_length, sizeof(record_header->chain_length), checksum);
+  checksum = crc32c(&record_header->prev_record_offset, sizeof(record_header->prev_record_offset), checksum);
+  return crc32c(record_header + 1, record_header->data_length, checksum);
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::KeyValuePair::set(char * record_data, BufferFreer deleter)
+{
+  ReclamationPolicy::store(m_record_data, ReclamationPolicy::make(record_data, std::move(deleter)));
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::KeyValuePair::supersede(const uint64_t commit_seq)
+{
+  // only writers modify m_record_data, and they are serialized, so there is no need for an atomic load here
+  RecordHeader * record_header = reinterpret_cast<RecordHeader *>(const_cast<char *>(m_record_data.get()));
+  record_header->superseded_seq = commit_seq;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::pair<typename BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::RecordHandle, const char *>
+BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::KeyValuePair::get() const
+{
+  RecordHandle record = ReclamationPolicy::load(m_record_data);
+  RecordHandle key = ReclamationPolicy::alias(record, record.get() + sizeof(RecordHeader));
+  const char * value = strchr(key.get(), '\0') + 1;
+  return std::make_pair(std::move(key), value);
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::pair<std::string, std::string> BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::const_iterator::operator*()
+{
+  auto key_value_pair = m_iter->key_value_pair.get();
+  return std::make_pair(key_value_pair.first.get(), m_parent->read_value(key_value_pair.first.get()));
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+typename BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::const_iterator BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::const_iterator::operator++()
+{
+  ++m_iter;
+  return *this;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+typename BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::const_iterator BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::const_iterator::operator--()
+{
+  --m_iter;
+  return *this;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+std::vector<FileByteOffset> BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::quarantined_records()
+{
+  std::unique_lock<std::mutex> write_lock(m_write_mutex);
+  std::vector<FileByteOffset> offsets; offsets.reserve(m_quarantined_records.size());
+  for (const uint8_t * record : m_quarantined_records) {
+    offsets.push_back(m_buffer.offset_of(record));
+  }
+  return offsets;
+}
+
+// nothing refers to a quarantined record: it isn't indexed, and neither is any DELTA record that applies to it
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+size_t BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::reclaim_quarantined_records()
+{
+  std::unique_lock<std::mutex> write_lock(m_write_mutex);
+  for (const uint8_t * record : m_quarantined_records) {
+    m_buffer.free(record);
+  }
+  const size_t num_reclaimed = m_quarantined_records.size();
+  m_quarantined_records.clear();
+  m_num_quarantined_records = 0;
+  return num_reclaimed;
+}
+
+template <typename HashPolicy, typename AllocatorPolicy, typename ReclamationPolicy>
+void BasicConcurrentHashTable<HashPolicy, AllocatorPolicy, ReclamationPolicy>::print_stats() const
+{
+  wait_until_recovered();
+  size_t num_key_value_pairs = 0;
+  size_t smallest_value_size = std::numeric_limits<size_t>::max();
+  size_t largest_value_size = 0;
+  float average_value_size = 0.0f;
+  for (auto iter = begin(); iter != end(); ++iter) {
+    const std::pair<std::string, std::string> key_value_pair = *iter;
+    if (key_value_pair.second.length() < smallest_value_size) {
+      smallest_value_size = key_value_pair.second.length();
+    }
+    if (key_value_pair.second.length() > largest_value_size) {
+      largest_value_size = key_value_pair.second.length();
+    }
+    average_value_size += key_value_pair.second.length();
+    ++num_key_value_pairs;
+  }
+  average_value_size /= static_cast<float>(num_key_value_pairs);
+
+  size_t num_table_elements = 0;
+  for (auto iter = m_hash_table.begin(); iter != m_hash_table.end(); ++iter) {
+    if (iter->load(std::memory_order_relaxed) != nullptr) {
+      ++num_table_elements;
+    }
+  }
+  float load_factor = static_cast<float>(num_table_elements) / m_hash_table.size();
+
+  std::cout << "hash table stats:\n"
+            << "  store: " << (m_durability == Durability::VOLATILE ? "(volatile)" : m_path) << '\n'
+            << "  index slots: " << m_hash_table.size() << '\n'
+            << "  key-value pairs: " << num_key_value_pairs << '\n'
+            << "  elements in table: " << num_table_elements << '\n'
+            << "  load factor: " << load_factor << '\n'
+            << "  smallest value size (bytes): " << smallest_value_size << '\n'
+            << "  largest value size (bytes): " << largest_value_size << '\n'
+            << "  average value size (bytes): " << average_value_size << '\n'
+            << "  last committed sequence number: " << m_header->committed_seq << '\n'
+            << "  index: " << (m_index_loaded ? "loaded as saved by the last shutdown" : "rebuilt from the records") << '\n'
+            << "  index recovery time (ms): " << m_recovery_time.count() << '\n'
+            << "  index recovery threads: " << m_recovery_threads << '\n'
+            << "  quarantined records: " << m_num_quarantined_records << '\n'
+            << "  checksum failures on read: " << m_num_read_checksum_failures.load(std::memory_order_relaxed) << '\n'
+            << '\n';
+
+  if (m_log) {
+    m_log->print_stats();
+  }
+  m_buffer.print_stats();
+}
+
+#endif  // _HASH_TABLE_IMPL_HPP_
@@ -0,0 +1,146 @@
+#ifndef _HASH_TABLE_POLICIES_HPP_
+#define _HASH_TABLE_POLICIES_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include "file_backed_buffer.hpp"
+
+// policies that BasicConcurrentHashTable is parameterized on, chosen at compile time so that there is no indirection
+// on the lookup path. a HashPolicy is a function object from std::string_view to size_t. an AllocatorPolicy has the
+// interface of FileBackedBuffer, including its nested Pages, AllocatorParams and Residency types, which the table
+// takes its options from. a ReclamationPolicy decides how long a record a reader holds stays allocated
+
+// the default, std::hash of the key's bytes
+using StdHash = std::hash<std::string_view>;
+
+// 64 bit FNV-1a, which unlike std::hash gives the same hashes on every platform and standard library
+struct Fnv1aHash {
+  size_t operator()(const std::string_view key) const
+  {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char c : key) {
+      hash ^= static_cast<uint8_t>(c);
+      hash *= 0x100000001b3ULL;
+    }
+    return hash;
+  }
+};
+
+// a hint for a lookup about to copy a shared_ptr that may be stored to concurrently: what it points at, and its control
+// block, which the copy increments. the two words are read one at a time, as libstdc++ and libc++ lay them out (the
+// pointer, then the control block), and may be torn, which costs nothing more than a useless prefetch
+inline void prefetch_shared_ptr(const std::shared_ptr<const char> & record)
+{
+  static_assert(sizeof(record) == 2 * sizeof(void *), "a shared_ptr is expected to be a pointer and a control block");
+  void * const * words = reinterpret_cast<void * const *>(&record);
+  __builtin_prefetch(__atomic_load_n(&words[0], __ATOMIC_RELAXED));
+  __builtin_prefetch(__atomic_load_n(&words[1], __ATOMIC_RELAXED));
+}
+
+// reference counted records, freed by the deleter when the last reader or bucket lets go of them
+// the handle is swapped atomically in a bucket, so readers never take a lock
+struct SharedPtrReclamation {
+  using Handle = std::shared_ptr<const char>;
+
+  template <typename Deleter>
+  static Handle make(const char * record, Deleter deleter) { return Handle(record, std::move(deleter)); }
+
+  // a handle pointing at ptr, keeping the record that owns it alive
+  static Handle alias(const Handle & owner, const char * ptr) { return Handle(owner, ptr); }
+
+  static Handle load(const Handle & handle) { return std::atomic_load_explicit(&handle, std::memory_order_acquire); }
+  static void prefetch(const Handle & handle) { prefetch_shared_ptr(handle); }
+  static void store(Handle & handle, Handle value) { std::atomic_store_explicit(&handle, std::move(value), std::memory_order_release); }
+};
+
+// reference counted like SharedPtrReclamation, but a handle in a bucket is guarded by a spinlock of its own instead of
+// the standard library's atomic shared_ptr functions, which in libstdc++ lock one of a small pool of mutexes picked by
+// address. readers of different keys then never wait on each other
+struct SpinlockSharedPtrReclamation {
+  class Handle
+  {
+  public:
+    Handle() : m_locked(false) {}
+    Handle(std::shared_ptr<const char> record) : m_record(std::move(record)), m_locked(false) {}
+    Handle(const Handle & other) : m_record(other.m_record), m_locked(false) {}
+    Handle(Handle && other) noexcept : m_record(std::move(other.m_record)), m_locked(false) {}
+    Handle & operator=(const Handle & other) { m_record = other.m_record; return *this; }
+    Handle & operator=(Handle && other) noexcept { m_record = std::move(other.m_record); return *this; }
+
+    const char * get() const { return m_record.get(); }
+
+  private:
+    friend struct SpinlockSharedPtrReclamation;
+
+    void lock() const
+    {
+      while (m_locked.exchange(true, std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+    }
+    void unlock() const { m_locked.store(false, std::memory_order_release); }
+
+    std::shared_ptr<const char> m_record;
+    mutable std::atomic<bool> m_locked;  // only taken on a handle that is loaded from and stored to concurrently
+  };
+
+  template <typename Deleter>
+  static Handle make(const char * record, Deleter deleter) { return Handle(std::shared_ptr<const char>(record, std::move(deleter))); }
+
+  static Handle alias(const Handle & owner, const char * ptr) { return Handle(std::shared_ptr<const char>(owner.m_record, ptr)); }
+
+  static Handle load(const Handle & handle)
+  {
+    handle.lock();
+    Handle result(handle.m_record);
+    handle.unlock();
+    return result;
+  }
+  static void prefetch(const Handle & handle) { prefetch_shared_ptr(handle.m_record); }
+  // the record that was in handle is released after the lock is, in case this was the last reference to it
+  static void store(Handle & handle, Handle value)
+  {
+    handle.lock();
+    handle.m_record.swap(value.m_record);
+    handle.unlock();
+  }
+};
+
+// rounds every allocation up to a size class, four to each power of two, so that the block a record leaves behind
+// fits any later record of the same class exactly. trades up to a quarter of each allocation for less fragmentation of
+// the free list when values of varying sizes are rewritten
+class SizeClassBuffer : public FileBackedBuffer
+{
+public:
+  using FileBackedBuffer::FileBackedBuffer;
+
+  uint8_t * alloc(const size_t alloc_size) { return FileBackedBuffer::alloc(size_class_of(alloc_size)); }
+  std::vector<uint8_t *> alloc_batch(const std::vector<size_t> & alloc_sizes, const bool all_or_nothing)
+  {
+    std::vector<size_t> class_sizes; class_sizes.reserve(alloc_sizes.size());
+    for (const size_t alloc_size : alloc_sizes) {
+      class_sizes.push_back(size_class_of(alloc_size));
+    }
+    return FileBackedBuffer::alloc_batch(class_sizes, all_or_nothing);
+  }
+
+  static size_t size_class_of(const size_t size)
+  {
+    if (size <= MIN_SIZE_CLASS) {
+      return MIN_SIZE_CLASS;
+    }
+    const size_t step = (size_t(1) << (63 - __builtin_clzll(size - 1))) / 4;  // a quarter of the power of two below
+    return (size + step - 1) / step * step;
+  }
+
+private:
+  static constexpr size_t MIN_SIZE_CLASS = 64;  // bytes
+};
+
+#endif  // _HASH_TABLE_POLICIES_HPP_
@@ -0,0 +1,49 @@
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "huge_pages.hpp"
+
+
+constexpr size_t DEFAULT_HUGE_PAGE_SIZE = 2097152;
+
+size_t huge_page_size()
+{
+  static const size_t size = []() -> size_t {
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+    size_t pmd_size = 0;
+    return (file >> pmd_size && pmd_size > 0) ? pmd_size : DEFAULT_HUGE_PAGE_SIZE;
+  }();
+  return size;
+}
+
+void * map_huge(const size_t size, const int prot, const int flags, const int fd, const off_t offset)
+{
+  // reserve enough address space to find an aligned start in, map over it, and give back the rest
+  const size_t alignment = huge_page_size();
+  void * reserved = mmap(nullptr, size + alignment, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED) {
+    return MAP_FAILED;
+  }
+  const uintptr_t reserved_start = reinterpret_cast<uintptr_t>(reserved);
+  const uintptr_t start = (reserved_start + alignment - 1) & ~(alignment - 1);
+  void * pointer = mmap(reinterpret_cast<void *>(start), size, prot, flags | MAP_FIXED, fd, offset);
+  if (pointer == MAP_FAILED) {
+    munmap(reserved, size + alignment);
+    return MAP_FAILED;
+  }
+  if (start > reserved_start) {
+    munmap(reserved, start - reserved_start);
+  }
+  const uintptr_t end = start + ((size + getpagesize() - 1) & ~static_cast<size_t>(getpagesize() - 1));
+  if (reserved_start + size + alignment > end) {
+    munmap(reinterpret_cast<void *>(end), reserved_start + size + alignment - end);
+  }
+
+  if (madvise(pointer, size, MADV_HUGEPAGE) != 0) {
+    std::cerr << "[WARN] the kernel won't back this mapping with transparent huge pages\n";
+  }
+  return pointer;
+}
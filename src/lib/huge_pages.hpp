@@ -0,0 +1,64 @@
+#ifndef _HUGE_PAGES_HPP_
+#define _HUGE_PAGES_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+// the size of a transparent huge page (a PMD mapping), as reported by the kernel
+size_t huge_page_size();
+
+// mmap() at an address aligned to huge_page_size(), so that the kernel can map the range with huge pages, and asks it
+// to with MADV_HUGEPAGE. for a file mapping, the file offset must be aligned too. undone with munmap(), as usual
+// returns MAP_FAILED on failure
+void * map_huge(const size_t size, const int prot, const int flags, const int fd, const off_t offset);
+
+// a std::allocator that puts allocations of at least a huge page on transparent huge pages, if asked to. for large
+// arrays that are accessed at random, such as the index, where it saves a TLB miss per access
+template <typename T>
+class HugePageAllocator
+{
+public:
+  using value_type = T;
+
+  explicit HugePageAllocator(const bool huge_pages = false) : m_huge_pages(huge_pages) {}
+  template <typename U>
+  HugePageAllocator(const HugePageAllocator<U> & other) : m_huge_pages(other.huge_pages()) {}
+
+  T * allocate(const size_t n)
+  {
+    if (!on_huge_pages(n)) {
+      return std::allocator<T>().allocate(n);
+    }
+    void * pointer = map_huge(n * sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pointer == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(pointer);
+  }
+
+  void deallocate(T * pointer, const size_t n)
+  {
+    if (!on_huge_pages(n)) {
+      std::allocator<T>().deallocate(pointer, n);
+    } else {
+      munmap(pointer, n * sizeof(T));
+    }
+  }
+
+  bool huge_pages() const { return m_huge_pages; }
+
+  template <typename U>
+  bool operator==(const HugePageAllocator<U> & other) const { return m_huge_pages == other.huge_pages(); }
+  template <typename U>
+  bool operator!=(const HugePageAllocator<U> & other) const { return m_huge_pages != other.huge_pages(); }
+
+private:
+  bool on_huge_pages(const size_t n) const { return m_huge_pages && n * sizeof(T) >= huge_page_size(); }
+
+  bool m_huge_pages;
+};
+
+#endif  // _HUGE_PAGES_HPP_
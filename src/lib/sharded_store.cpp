@@ -0,0 +1,176 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+#include "sharded_store.hpp"
+
+
+constexpr char BUFFER_EXTENSION[] = ".bin";
+
+// path without its .bin extension, if it has one
+static std::string stem_of(const std::string & path)
+{
+  const size_t extension_length = strlen(BUFFER_EXTENSION);
+  if (path.size() > extension_length && path.compare(path.size() - extension_length, extension_length, BUFFER_EXTENSION) == 0) {
+    return path.substr(0, path.size() - extension_length);
+  }
+  return path;
+}
+
+std::string ShardedStore::shard_path_of(const std::string & path, const size_t shard)
+{
+  const std::string stem = stem_of(path);
+  return stem + "." + std::to_string(shard) + (stem.size() < path.size() ? BUFFER_EXTENSION : "");
+}
+
+ShardedStore::ShardedStore(const size_t num_shards, const ConcurrentHashTable::Options & options) :
+  m_shards(num_shards)
+{
+  assert(num_shards > 0);
+
+  if (options.durability != Durability::VOLATILE) {
+    // keys would be looked for in the wrong shards with any other number of them
+    const std::string shards_path = stem_of(options.path) + SHARDS_EXTENSION;
+    size_t created_shards = 0;
+    if (std::ifstream(shards_path) >> created_shards) {
+      if (created_shards != num_shards) {
+        const std::string message = options.path + " was created with " + std::to_string(created_shards) + " shards, not " + std::to_string(num_shards);
+        std::cerr << "[ERROR] " << message << '\n';
+        throw std::runtime_error(message);
+      }
+    } else if (!(std::ofstream(shards_path) << num_shards << '\n')) {
+      std::cerr << "[WARN] failed to record the number of shards in " << shards_path << '\n';
+    }
+  }
+
+  ConcurrentHashTable::Options shard_options = options;
+  shard_options.buffer_size = options.buffer_size / num_shards;
+  shard_options.expected_keys = (options.expected_keys + num_shards - 1) / num_shards;
+  std::vector<std::thread> threads; threads.reserve(num_shards);
+  for (size_t i = 0; i < num_shards; ++i) {
+    threads.emplace_back([this, shard_options, &options, i]() mutable -> void {
+      shard_options.path = shard_path_of(options.path, i);
+      m_shards[i] = std::make_unique<ConcurrentHashTable>(shard_options);
+    });
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+}
+
+size_t ShardedStore::shard_of(const std::string & key) const
+{
+  // from the high bits of the mixed hash, so that the shard doesn't depend on the same bits as the key's slot within it.
+  // the hash is part of the file format, std::hash isn't the same from one standard library to the next
+  const uint64_t hash = static_cast<uint64_t>(Fnv1aHash()(key)) * 0x9e3779b97f4a7c15;
+  return ((hash >> 32) * m_shards.size()) >> 32;
+}
+
+size_t ShardedStore::put_batch(const std::vector<std::pair<std::string, std::string>> & key_value_pairs, const BatchMode mode)
+{
+  std::vector<std::vector<std::pair<std::string, std::string>>> shard_batches(m_shards.size());
+  for (const auto & key_value_pair : key_value_pairs) {
+    shard_batches[shard_of(key_value_pair.first)].push_back(key_value_pair);
+  }
+
+  size_t num_written = 0;
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    if (!shard_batches[i].empty()) {
+      num_written += m_shards[i]->put_batch(shard_batches[i], mode);
+    }
+  }
+  return num_written;
+}
+
+std::vector<std::string> ShardedStore::multi_get(const std::vector<std::string> & keys)
+{
+  // each shard looks up its keys as one batch, and the values go back to where their keys were
+  std::vector<std::vector<std::string>> shard_keys(m_shards.size());
+  std::vector<std::vector<size_t>> shard_positions(m_shards.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const size_t shard = shard_of(keys[i]);
+    shard_keys[shard].push_back(keys[i]);
+    shard_positions[shard].push_back(i);
+  }
+
+  std::vector<std::string> results(keys.size());
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    if (shard_keys[i].empty()) {
+      continue;
+    }
+    std::vector<std::string> values = m_shards[i]->multi_get(shard_keys[i]);
+    for (size_t j = 0; j < values.size(); ++j) {
+      results[shard_positions[i][j]] = std::move(values[j]);
+    }
+  }
+  return results;
+}
+
+void ShardedStore::set_verify_reads(const bool verify_reads)
+{
+  for (auto & shard : m_shards) {
+    shard->set_verify_reads(verify_reads);
+  }
+}
+
+void ShardedStore::set_residency(const FileBackedBuffer::Residency & residency)
+{
+  for (auto & shard : m_shards) {
+    shard->set_residency(residency);
+  }
+}
+
+ShardedStore::const_iterator::const_iterator(const ShardedStore * parent, const size_t shard) :
+  m_parent(parent),
+  m_shard(shard),
+  m_iter(shard < parent->m_shards.size() ? parent->m_shards[shard]->begin() : parent->m_shards.back()->end())
+{
+  skip_finished_shards();
+}
+
+ShardedStore::const_iterator ShardedStore::const_iterator::operator++()
+{
+  ++m_iter;
+  skip_finished_shards();
+  return *this;
+}
+
+// the end of every shard but the last moves on to the start of the next, the end of the last shard is the end
+void ShardedStore::const_iterator::skip_finished_shards()
+{
+  const auto & shards = m_parent->m_shards;
+  while (m_shard < shards.size() && m_iter == shards[m_shard]->end()) {
+    ++m_shard;
+    m_iter = m_shard < shards.size() ? shards[m_shard]->begin() : shards.back()->end();
+  }
+}
+
+void ShardedStore::print_stats() const
+{
+  std::vector<size_t> shard_sizes(m_shards.size(), 0);
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    for (auto iter = m_shards[i]->begin(); iter != m_shards[i]->end(); ++iter) {
+      ++shard_sizes[i];
+    }
+  }
+  size_t num_key_value_pairs = 0;
+  for (const size_t shard_size : shard_sizes) {
+    num_key_value_pairs += shard_size;
+  }
+
+  std::cout << "sharded store stats:\n"
+            << "  shards: " << m_shards.size() << '\n'
+            << "  key-value pairs: " << num_key_value_pairs << '\n'
+            << "  fewest key-value pairs in a shard: " << *std::min_element(shard_sizes.begin(), shard_sizes.end()) << '\n'
+            << "  most key-value pairs in a shard: " << *std::max_element(shard_sizes.begin(), shard_sizes.end()) << '\n'
+            << '\n';
+
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    std::cout << "shard " << i << ":\n";
+    m_shards[i]->print_stats();
+  }
+}
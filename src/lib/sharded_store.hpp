@@ -0,0 +1,96 @@
+#ifndef _SHARDED_STORE_HPP_
+#define _SHARDED_STORE_HPP_
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <utility>
+
+#include "hash_table.hpp"
+
+// spreads keys by hash over independent ConcurrentHashTables, each with its own store file, buffer, write lock and
+// log, so that writers to different shards don't wait on each other and write throughput scales with the number of
+// shards (up to the number of cores, or what the disk can sync). a lookup goes to the one shard holding the key, and
+// is as lockless as ever
+// a key always lives in the same shard, so a store has to be reopened with the number of shards it was created with,
+// which is recorded next to the shard files. what spans several keys is only per shard: put_batch() is atomic within
+// each shard, and multi_get() is consistent with respect to each shard's part of a batch on its own
+class ShardedStore
+{
+public:
+  using Durability = ConcurrentHashTable::Durability;
+  using BatchMode = ConcurrentHashTable::BatchMode;
+  using MergeOperator = ConcurrentHashTable::MergeOperator;
+
+  // options.path names the store, see shard_path_of(). options.buffer_size and options.expected_keys are for the whole
+  // store, and are split evenly between the shards. every shard gets the rest of options, options.merge_operator
+  // included, before it is opened. the shards are opened (and recovered) in parallel. throws std::runtime_error if the
+  // store was created with a different number of shards
+  ShardedStore(const size_t num_shards, const ConcurrentHashTable::Options & options);
+
+  // shard of the store at path: path with ".<shard>" inserted before its .bin extension, if any, or appended
+  static std::string shard_path_of(const std::string & path, const size_t shard);
+
+  size_t num_shards() const { return m_shards.size(); }
+  size_t shard_of(const std::string & key) const;
+  ConcurrentHashTable & shard(const size_t shard) { return *m_shards[shard]; }
+
+  // as for ConcurrentHashTable, on the shard of key
+  bool put(const std::string & key, const std::string & value) { return m_shards[shard_of(key)]->put(key, value); }
+  std::string get(const std::string & key) { return m_shards[shard_of(key)]->get(key); }
+  std::pair<std::string, uint64_t> get_versioned(const std::string & key) { return m_shards[shard_of(key)]->get_versioned(key); }
+  bool put_if_version(const std::string & key, const std::string & value, const uint64_t expected_version)
+  {
+    return m_shards[shard_of(key)]->put_if_version(key, value, expected_version);
+  }
+  bool merge(const std::string & key, const std::string & delta) { return m_shards[shard_of(key)]->merge(key, delta); }
+  bool fetch_add(const std::string & key, const int64_t delta, int64_t & previous_value)
+  {
+    return m_shards[shard_of(key)]->fetch_add(key, delta, previous_value);
+  }
+  bool compare_exchange(const std::string & key, int64_t & expected_value, const int64_t desired_value)
+  {
+    return m_shards[shard_of(key)]->compare_exchange(key, expected_value, desired_value);
+  }
+
+  // split by shard, with mode applying to each shard's part of the batch on its own
+  size_t put_batch(const std::vector<std::pair<std::string, std::string>> & key_value_pairs, const BatchMode mode);
+  std::vector<std::string> multi_get(const std::vector<std::string> & keys);
+
+  void set_verify_reads(const bool verify_reads);
+  void set_residency(const FileBackedBuffer::Residency & residency);
+
+  // every key-value pair of every shard, one shard after the other
+  class const_iterator
+  {
+  public:
+    const_iterator(const ShardedStore * parent, const size_t shard);
+
+    std::pair<std::string, std::string> operator*() { return *m_iter; }
+
+    const_iterator operator++();
+
+    bool operator==(const const_iterator & other) const { return other.m_shard == m_shard && other.m_iter == m_iter; }
+    bool operator!=(const const_iterator & other) const { return !(*this == other); }
+
+  private:
+    void skip_finished_shards();
+
+    const ShardedStore * m_parent;
+    size_t m_shard;
+    ConcurrentHashTable::const_iterator m_iter;
+  };
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, m_shards.size()); }
+
+  void print_stats() const;
+
+private:
+  // records how many shards the store was created with
+  static constexpr char SHARDS_EXTENSION[] = ".shards";
+
+  std::vector<std::unique_ptr<ConcurrentHashTable>> m_shards;
+};
+
+#endif  // _SHARDED_STORE_HPP_
@@ -0,0 +1,255 @@
+#include <iostream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cassert>
+#include <algorithm>
+#include <string>
+
+#include "write_ahead_log.hpp"
+
+
+// 64 bit FNV-1a, continued from hash
+static uint64_t checksum_of(uint64_t hash, const void * data, const size_t size)
+{
+  const uint8_t * bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static uint64_t checksum_of(const void * header, const size_t header_size, const std::string_view key, const std::string_view value)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  hash = checksum_of(hash, header, header_size);
+  hash = checksum_of(hash, key.data(), key.size());
+  hash = checksum_of(hash, value.data(), value.size());
+  return hash;
+}
+
+WriteAheadLog::WriteAheadLog(const char * filename, const int fd) :
+  m_fd(fd),
+  m_size(0),
+  m_appended_lsn(0),
+  m_append_failed(false),
+  m_syncing(false),
+  m_durable_lsn(0),
+  m_sync_failed(false),
+  m_num_appends(0),
+  m_num_sync_requests(0),
+  m_num_syncs(0)
+{
+  if (m_fd < 0) {
+    m_fd = open(filename, O_RDWR | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    if (m_fd < 0) {
+      int err = errno;
+      std::cerr << "[ERROR] opening " << filename << " failed: " << strerror(err) << '\n';
+    }
+  }
+  assert(m_fd >= 0);
+
+  struct stat stat_buf;
+  if (fstat(m_fd, &stat_buf) == 0) {
+    m_size = stat_buf.st_size;
+  }
+  std::cout << "[INFO] log file size: " << m_size << " bytes\n";
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+}
+
+uint64_t WriteAheadLog::append(const std::vector<Entry> & entries)
+{
+  std::unique_lock<std::mutex> append_lock(m_append_mutex);
+  return append_locked(entries);
+}
+
+uint64_t WriteAheadLog::append_locked(const std::vector<Entry> & entries)
+{
+  if (m_append_failed) {
+    return 0;
+  }
+
+  // the unit goes out in a single write, so that entries of different units never interleave
+  std::string data;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    EntryHeader header;
+    header.version = entries[i].version;
+    header.type = entries[i].type;
+    header.num_following = entries.size() - i - 1;
+    header.key_length = entries[i].key.size();
+    header.value_length = entries[i].value.size();
+    header.checksum = checksum_of(reinterpret_cast<const uint8_t *>(&header) + sizeof(header.checksum),
+                                  sizeof(EntryHeader) - sizeof(header.checksum),
+                                  entries[i].key,
+                                  entries[i].value);
+    data.append(reinterpret_cast<const char *>(&header), sizeof(EntryHeader));
+    data.append(entries[i].key);
+    data.append(entries[i].value);
+  }
+
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t result = write(m_fd, data.data() + written, data.size() - written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int err = errno;
+      std::cerr << "[ERROR] appending to log failed: " << strerror(err) << '\n';
+      // later units would be cut off along with this one by replay(), unless it's cut off now
+      if (written > 0 && ftruncate(m_fd, m_size) != 0) {
+        err = errno;
+        std::cerr << "[ERROR] truncating torn log unit failed: " << strerror(err) << '\n';
+        m_append_failed = true;
+      }
+      return 0;
+    }
+    written += result;
+  }
+
+  m_size += written;
+  m_appended_lsn += written;
+  m_num_appends.fetch_add(1, std::memory_order_relaxed);
+  return m_appended_lsn;
+}
+
+bool WriteAheadLog::sync(const uint64_t lsn)
+{
+  m_num_sync_requests.fetch_add(1, std::memory_order_relaxed);
+
+  std::unique_lock<std::mutex> sync_lock(m_sync_mutex);
+  while (m_durable_lsn < lsn) {
+    if (m_sync_failed) {
+      return false;
+    }
+    if (m_syncing) {
+      // the sync in progress might not cover lsn, in which case this thread leads the next one
+      m_sync_done.wait(sync_lock);
+      continue;
+    }
+
+    // lead a sync on behalf of every append made so far
+    m_syncing = true;
+    sync_lock.unlock();
+    uint64_t appended_lsn;
+    {
+      std::unique_lock<std::mutex> append_lock(m_append_mutex);
+      appended_lsn = m_appended_lsn;
+    }
+    const bool synced = (fdatasync(m_fd) == 0);
+    if (!synced) {
+      int err = errno;
+      std::cerr << "[ERROR] syncing log failed: " << strerror(err) << '\n';
+    }
+    m_num_syncs.fetch_add(1, std::memory_order_relaxed);
+    sync_lock.lock();
+
+    m_syncing = false;
+    if (synced) {
+      m_durable_lsn = std::max(m_durable_lsn, appended_lsn);
+    } else {
+      m_sync_failed = true;
+    }
+    m_sync_done.notify_all();
+  }
+  return true;
+}
+
+size_t WriteAheadLog::replay(const std::function<void(const Entry &)> & apply)
+{
+  std::unique_lock<std::mutex> append_lock(m_append_mutex);
+
+  std::string data(m_size, '\0');
+  size_t num_read = 0;
+  while (num_read < data.size()) {
+    const ssize_t result = pread(m_fd, &data[num_read], data.size() - num_read, num_read);
+    if (result <= 0) {
+      break;
+    }
+    num_read += result;
+  }
+  data.resize(num_read);
+
+  // read a unit at a time, applying it only once all of its entries have been read back intact
+  size_t num_applied = 0;
+  size_t unit_start = 0;
+  std::vector<Entry> unit;
+  size_t offset = 0;
+  while (offset + sizeof(EntryHeader) <= data.size()) {
+    EntryHeader header;
+    memcpy(&header, &data[offset], sizeof(EntryHeader));
+    const size_t entry_size = sizeof(EntryHeader) + header.key_length + header.value_length;
+    if (entry_size > data.size() - offset) {
+      break;
+    }
+    const std::string_view key(&data[offset + sizeof(EntryHeader)], header.key_length);
+    const std::string_view value(&data[offset + sizeof(EntryHeader) + header.key_length], header.value_length);
+    const uint64_t checksum = checksum_of(reinterpret_cast<const uint8_t *>(&header) + sizeof(header.checksum),
+                                          sizeof(EntryHeader) - sizeof(header.checksum),
+                                          key,
+                                          value);
+    if (checksum != header.checksum) {
+      break;
+    }
+    offset += entry_size;
+
+    unit.push_back(Entry{header.type, header.version, key, value});
+    if (header.num_following == 0) {
+      for (const Entry & entry : unit) {
+        apply(entry);
+      }
+      num_applied += unit.size();
+      unit.clear();
+      unit_start = offset;
+    }
+  }
+
+  if (unit_start < m_size) {
+    std::cerr << "[WARN] discarding " << m_size - unit_start << " bytes torn off the end of the log\n";
+    if (ftruncate(m_fd, unit_start) != 0) {
+      int err = errno;
+      std::cerr << "[ERROR] truncating log failed: " << strerror(err) << '\n';
+    }
+    m_size = unit_start;
+  }
+
+  return num_applied;
+}
+
+bool WriteAheadLog::truncate()
+{
+  if (ftruncate(m_fd, 0) != 0 || fdatasync(m_fd) != 0) {
+    int err = errno;
+    std::cerr << "[ERROR] truncating log failed: " << strerror(err) << '\n';
+    return false;
+  }
+  m_size = 0;
+  m_append_failed = false;
+
+  // whatever was appended before is durable by other means now
+  std::unique_lock<std::mutex> sync_lock(m_sync_mutex);
+  m_durable_lsn = std::max(m_durable_lsn, m_appended_lsn);
+  return true;
+}
+
+void WriteAheadLog::print_stats() const
+{
+  const uint64_t num_appends = m_num_appends.load(std::memory_order_relaxed);
+  const uint64_t num_syncs = m_num_syncs.load(std::memory_order_relaxed);
+  std::cout << "write-ahead log stats:\n"
+            << "  size (bytes): " << m_size << '\n'
+            << "  appends: " << num_appends << '\n'
+            << "  sync requests: " << m_num_sync_requests.load(std::memory_order_relaxed) << '\n'
+            << "  syncs: " << num_syncs << '\n'
+            << "  appends per sync: " << (num_syncs == 0 ? 0.0f : static_cast<float>(num_appends) / num_syncs) << '\n'
+            << '\n';
+}
@@ -0,0 +1,88 @@
+#ifndef _WRITE_AHEAD_LOG_HPP_
+#define _WRITE_AHEAD_LOG_HPP_
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+// an append-only log of the writes made to a store, to redo the writes that didn't reach the disk before a power loss
+// append() only goes as far as the page cache, sync() makes the appends durable. a sync() that arrives while another
+// thread is already syncing waits for it, and then the waiting threads share the next fdatasync() (group commit),
+// so concurrent writers pay for one sync between them instead of one each
+class WriteAheadLog
+{
+public:
+  enum class EntryType : uint32_t {
+    PUT,     // value is the whole value
+    MERGE,   // value is a merge operand
+    COUNTER  // value is the int64_t value of the counter after the update
+  };
+
+  struct Entry {
+    EntryType type;
+    uint64_t version;  // version of the key after the write
+    std::string_view key;
+    std::string_view value;
+  };
+
+  // fd, if given, is an already open descriptor of the log file to use instead of opening filename. the log takes
+  // ownership of it
+  explicit WriteAheadLog(const char * filename, const int fd = -1);
+  ~WriteAheadLog();
+
+  // appends entries as one unit, replay() skips the whole unit if the log was cut off part way through it
+  // returns the log sequence number to pass to sync(), or 0 if the write failed. what part of the unit was written is
+  // cut off again, and if even that fails, every later append fails too, as it would be lost behind the torn unit
+  uint64_t append(const std::vector<Entry> & entries);
+  // for ordering appends with updates that aren't made under any other lock, call with lock() held
+  uint64_t append_locked(const std::vector<Entry> & entries);
+  std::unique_lock<std::mutex> lock() { return std::unique_lock<std::mutex>(m_append_mutex); }
+
+  // blocks until everything appended up to lsn is on disk, returns false if it couldn't be made durable
+  // a failed fdatasync() may have dropped the pages it was writing back, so every later sync fails too, until the log
+  // is reopened and replayed
+  bool sync(const uint64_t lsn);
+
+  // calls apply on the entries of every whole unit in the log, in the order they were appended, and cuts off a torn
+  // unit at the end of the log. returns the number of entries applied
+  size_t replay(const std::function<void(const Entry &)> & apply);
+
+  // empties the log, once everything in it is durable somewhere else. call with lock() held
+  bool truncate();
+
+  uint64_t size() const { return m_size; }  // bytes, call with lock() held
+  int fd() const { return m_fd; }
+  void print_stats() const;
+
+private:
+  struct EntryHeader {
+    uint64_t checksum;  // of the rest of the entry, so that a torn append isn't mistaken for an entry
+    uint64_t version;
+    EntryType type;
+    uint32_t num_following;  // entries after this one in the same unit
+    uint32_t key_length;
+    uint32_t value_length;
+  };
+
+  int m_fd;
+  std::mutex m_append_mutex;
+  uint64_t m_size;  // of the file
+  uint64_t m_appended_lsn;  // bytes appended over the lifetime of this object, guarded by m_append_mutex
+  bool m_append_failed;  // a failed append couldn't be cut off the end of the file, guarded by m_append_mutex
+
+  std::mutex m_sync_mutex;
+  std::condition_variable m_sync_done;
+  bool m_syncing;  // a thread is in fdatasync(), for everything appended up to when it started
+  uint64_t m_durable_lsn;
+  bool m_sync_failed;
+
+  std::atomic<uint64_t> m_num_appends;
+  std::atomic<uint64_t> m_num_sync_requests;
+  std::atomic<uint64_t> m_num_syncs;
+};
+
+#endif  // _WRITE_AHEAD_LOG_HPP_
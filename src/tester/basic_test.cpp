@@ -1,11 +1,42 @@
 #include <cassert>
 #include <cstring>
+#include <climits>
+#include <algorithm>
 #include <thread>
 #include <iostream>
 #include <iomanip>
+#include <map>
+#include <unordered_set>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "file_backed_buffer.hpp"
 #include "hash_table.hpp"
+#include "sharded_store.hpp"
+#include "fixed_size_hash_table.hpp"
+#include "write_ahead_log.hpp"
+#include "crc32c.hpp"
+
+constexpr char FIXED_SIZE_BUFFER_FILENAME[] = "kvfixed.bin";
+constexpr char TEST_LOG_FILENAME[] = "kvtest.wal";
+constexpr char TEST_BUFFER_FILENAME[] = "kvtest.bin";
+constexpr char TEST_COPY_FILENAME[] = "kvtest.copy";
+constexpr char CHECKPOINT_FILENAME[] = "kvcheckpoint.bin";
+constexpr char BACKUP_DIRECTORY[] = "kvbackup";
+constexpr char RESTORED_FILENAME[] = "kvrestored.bin";
+constexpr char SMALL_STORE_FILENAME[] = "kvtest.small.bin";
+constexpr char LARGE_STORE_FILENAME[] = "kvtest.large.bin";
+constexpr char SHARDED_STORE_FILENAME[] = "kvtest.sharded.bin";
+constexpr char TORN_STORE_FILENAME[] = "kvtest.torn.bin";
+constexpr char MERGE_STORE_FILENAME[] = "kvtest.merge.bin";
+constexpr char SNAPSHOT_STORE_FILENAME[] = "kvtest.snapshot.bin";
 
 
 void memfill(uint8_t * buffer, const size_t buffer_size, const uint32_t pattern_data)
@@ -39,6 +70,25 @@ void test_buffer(const char * buffer_filename)
 
   buffer.free(alloc4);
 
+  const std::vector<uint8_t *> batch = buffer.alloc_batch({24, 48, 96}, true);
+  assert(batch.size() == 3);
+  assert(batch[0] != nullptr && batch[1] != nullptr && batch[2] != nullptr);
+  assert(batch[0] < batch[1] && batch[1] < batch[2]);  // carved contiguously
+  memfill(batch[0], 24, 0xC0FFEE00);
+  memfill(batch[1], 48, 0xC0FFEE00);
+  memfill(batch[2], 96, 0xC0FFEE00);
+  const std::vector<uint8_t *> failed_batch = buffer.alloc_batch({16, 1UL << 40}, true);
+  assert(failed_batch == std::vector<uint8_t *>(2, nullptr));
+
+  // only the pages written to since the last sync are written back
+  assert(buffer.num_dirty_pages() > 0);
+  buffer.sync();
+  assert(buffer.num_dirty_pages() == 0);
+  buffer.mark_dirty(batch[1], 48);
+  assert(buffer.num_dirty_pages() >= 1 && buffer.num_dirty_pages() <= 2);
+  buffer.sync();
+  assert(buffer.num_dirty_pages() == 0);
+
   std::cout << "used data:\n";
   for (auto iter = buffer.begin_used(); iter != buffer.end_used(); ++iter) {
     const std::pair<uint8_t *, size_t> data = *iter;
@@ -58,10 +108,8 @@ void test_buffer(const char * buffer_filename)
   buffer.print_stats();
 }
 
-void test_hash_table()
+void test_hash_table(ConcurrentHashTable * hash_table)
 {
-  ConcurrentHashTable * hash_table = new ConcurrentHashTable();
-
   constexpr size_t NUM_THREADS = 8;
   std::vector<std::thread> threads; threads.reserve(NUM_THREADS);
   for (size_t i = 0; i < NUM_THREADS; ++i) {
@@ -90,17 +138,1078 @@ void test_hash_table()
   std::cout << "end key-value pairs\n\n";
 
   hash_table->print_stats();
+}
+
+void test_write_batch(ConcurrentHashTable * hash_table)
+{
+  // writers commit the same value to a pair of keys, readers must never see them differ
+  constexpr size_t NUM_WRITERS = 4;
+  constexpr size_t NUM_READERS = 4;
+  const std::vector<std::string> keys = {"batch_key_a", "batch_key_b"};
+  std::vector<std::thread> threads; threads.reserve(NUM_WRITERS + NUM_READERS);
+  for (size_t i = 0; i < NUM_WRITERS; ++i) {
+    threads.emplace_back([hash_table, &keys, i]() -> void {
+      for (int j = 0; j < 1000; ++j) {
+        const std::string value = "thread" + std::to_string(i) + " batch" + std::to_string(j);
+        ConcurrentHashTable::WriteBatch batch;
+        for (const std::string & key : keys) {
+          batch.put(key, value);
+        }
+        const bool success = hash_table->commit(batch);
+        assert(success);
+      }
+    });
+  }
+  for (size_t i = 0; i < NUM_READERS; ++i) {
+    threads.emplace_back([hash_table, &keys]() -> void {
+      for (int j = 0; j < 1000; ++j) {
+        const std::vector<std::string> values = hash_table->multi_get(keys);
+        assert(values[0] == values[1]);
+      }
+    });
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+
+  const std::vector<std::string> values = hash_table->multi_get(keys);
+  std::cout << "committed batch: " << keys[0] << ": " << values[0] << ", " << keys[1] << ": " << values[1] << "\n\n";
+}
+
+void test_put_if_version(ConcurrentHashTable * hash_table)
+{
+  // optimistic read-modify-write loops from multiple threads must not lose any increments
+  constexpr size_t NUM_THREADS = 8;
+  constexpr int NUM_INCREMENTS = 1000;
+  const std::string key = "cas_counter";
+  const std::string initial = hash_table->get(key);
+  const long initial_count = initial.empty() ? 0 : std::stol(initial);
+
+  std::vector<std::thread> threads; threads.reserve(NUM_THREADS);
+  for (size_t i = 0; i < NUM_THREADS; ++i) {
+    threads.emplace_back([hash_table, &key]() -> void {
+      for (int j = 0; j < NUM_INCREMENTS; ++j) {
+        while (true) {
+          const std::pair<std::string, uint64_t> existing = hash_table->get_versioned(key);
+          const long count = existing.first.empty() ? 0 : std::stol(existing.first);
+          if (hash_table->put_if_version(key, std::to_string(count + 1), existing.second)) {
+            break;
+          }
+        }
+      }
+    });
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+
+  const long final_count = std::stol(hash_table->get(key));
+  std::cout << key << ": " << initial_count << " -> " << final_count << "\n\n";
+  assert(final_count == initial_count + static_cast<long>(NUM_THREADS) * NUM_INCREMENTS);
+}
+
+void test_merge(ConcurrentHashTable * hash_table)
+{
+  // appends from multiple threads through the merge operator, long enough to be folded a few times
+  constexpr size_t NUM_THREADS = 8;
+  constexpr int NUM_APPENDS = 100;
+  const std::string key = "merge_key";
+  const size_t initial_length = hash_table->get(key).length();
+
+  std::vector<std::thread> threads; threads.reserve(NUM_THREADS);
+  for (size_t i = 0; i < NUM_THREADS; ++i) {
+    threads.emplace_back([hash_table, &key, i]() -> void {
+      for (int j = 0; j < NUM_APPENDS; ++j) {
+        const bool success = hash_table->merge(key, std::to_string(i));
+        assert(success);
+      }
+    });
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+
+  const std::string value = hash_table->get(key);
+  std::cout << key << ": " << initial_length << " -> " << value.length() << " bytes\n\n";
+  assert(value.length() == initial_length + NUM_THREADS * NUM_APPENDS);
+  for (size_t i = 0; i < NUM_THREADS; ++i) {
+    assert(std::count(value.begin() + initial_length, value.end(), '0' + i) == NUM_APPENDS);
+  }
+}
+
+// a merge operator given in the options is used from the moment the store is opened, for the deltas redone from the
+// log as much as for new ones
+void test_merge_operator()
+{
+  constexpr int NUM_MERGES = 40;  // enough to be folded twice
+  const std::string key = "sum_key";
+  unlink(MERGE_STORE_FILENAME);
+  unlink(ConcurrentHashTable::log_path_of(MERGE_STORE_FILENAME).c_str());
+  ConcurrentHashTable::Options options;
+  options.path = MERGE_STORE_FILENAME;
+  options.buffer_size = 4194304;
+  options.expected_keys = 1000;
+  options.durability = ConcurrentHashTable::Durability::LOG;
+  options.merge_operator = [](const std::string & existing_value, const std::string & delta) -> std::string {
+    return std::to_string((existing_value.empty() ? 0 : std::stol(existing_value)) + std::stol(delta));
+  };
+
+  long expected_sum = 0;
+  for (int reopen = 0; reopen < 2; ++reopen) {
+    ConcurrentHashTable hash_table(options);
+    assert(hash_table.get(key) == (expected_sum == 0 ? "" : std::to_string(expected_sum)));
+    for (int i = 1; i <= NUM_MERGES; ++i) {
+      const bool success = hash_table.merge(key, std::to_string(i));
+      assert(success);
+      expected_sum += i;
+    }
+    assert(hash_table.get(key) == std::to_string(expected_sum));
+  }
+  std::cout << key << ": " << expected_sum << "\n\n";
+}
+
+void test_counters(ConcurrentHashTable * hash_table)
+{
+  constexpr size_t NUM_THREADS = 8;
+  constexpr int NUM_INCREMENTS = 10000;
+  const std::string key = "atomic_counter";
+  const std::string initial = hash_table->get(key);
+  const int64_t initial_count = initial.empty() ? 0 : std::stoll(initial);
+
+  std::vector<std::thread> threads; threads.reserve(NUM_THREADS);
+  for (size_t i = 0; i < NUM_THREADS; ++i) {
+    threads.emplace_back([hash_table, &key]() -> void {
+      for (int j = 0; j < NUM_INCREMENTS; ++j) {
+        int64_t previous_value;
+        const bool success = hash_table->fetch_add(key, 1, previous_value);
+        assert(success);
+      }
+    });
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+
+  int64_t expected_value = 0;
+  const bool mismatch = hash_table->compare_exchange(key, expected_value, 0);
+  assert(!mismatch);
+  std::cout << key << ": " << initial_count << " -> " << expected_value << "\n\n";
+  assert(expected_value == initial_count + static_cast<int64_t>(NUM_THREADS) * NUM_INCREMENTS);
+  assert(hash_table->get(key) == std::to_string(expected_value));
+
+  int64_t previous_value;
+  const bool added = hash_table->fetch_add("merge_key", 1, previous_value);
+  assert(!added);  // not a counter
+}
+
+void test_overwrite_in_place(ConcurrentHashTable * hash_table)
+{
+  // same size values are overwritten in place, readers must never see a mix of two values
+  constexpr size_t NUM_READERS = 4;
+  constexpr size_t VALUE_LENGTH = 64;
+  const std::string key = "fixed_size_key";
+  std::atomic<bool> done(false);
+  hash_table->set_overwrite_in_place(true);
+
+  std::vector<std::thread> threads; threads.reserve(NUM_READERS + 1);
+  threads.emplace_back([hash_table, &key, &done]() -> void {
+    for (int j = 0; j < 10000; ++j) {
+      const bool success = hash_table->put(key, std::string(VALUE_LENGTH, 'a' + j % 26));
+      assert(success);
+    }
+    done = true;
+  });
+  for (size_t i = 0; i < NUM_READERS; ++i) {
+    threads.emplace_back([hash_table, &key, &done]() -> void {
+      while (!done) {
+        const std::string value = hash_table->get(key);
+        assert(value.empty() || (value.length() == VALUE_LENGTH && std::count(value.begin(), value.end(), value[0]) == VALUE_LENGTH));
+      }
+    });
+  }
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+
+  hash_table->set_overwrite_in_place(false);
+  const std::pair<std::string, uint64_t> value = hash_table->get_versioned(key);
+  std::cout << key << ": " << value.first.substr(0, 8) << "... (version " << value.second << ")\n\n";
+}
+
+// a process that dies part way through an overwrite in place, leaving the record's overwrite_seq odd
+void test_torn_overwrite()
+{
+  constexpr size_t NUM_OVERWRITES = 5;
+  const std::string key = "torn_overwrite_key";
+  const auto value_of = [](const size_t i) { return "value number " + std::to_string(i) + std::string(24, '.'); };
+
+  for (const auto durability : {ConcurrentHashTable::Durability::NONE, ConcurrentHashTable::Durability::LOG}) {
+    unlink(TORN_STORE_FILENAME);
+    unlink(ConcurrentHashTable::log_path_of(TORN_STORE_FILENAME).c_str());
+    ConcurrentHashTable::Options options;
+    options.path = TORN_STORE_FILENAME;
+    options.buffer_size = 4194304;
+    options.expected_keys = 1000;
+    options.durability = durability;
+
+    std::cout.flush();
+    const pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      ConcurrentHashTable * hash_table = new ConcurrentHashTable(options);
+      hash_table->set_overwrite_in_place(true);
+      for (size_t i = 0; i <= NUM_OVERWRITES; ++i) {
+        const bool written = hash_table->put(key, value_of(i));
+        assert(written);
+      }
+
+      // the sequence lock is the last field of the record header before the key that holds twice the number of
+      // overwrites, tear the record as a crash in the middle of the next overwrite would
+      const int fd = open(TORN_STORE_FILENAME, O_RDWR);
+      assert(fd >= 0);
+      const off_t file_size = lseek(fd, 0, SEEK_END);
+      char * mapping = static_cast<char *>(mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+      assert(mapping != MAP_FAILED);
+      char * record_key = static_cast<char *>(memmem(mapping, file_size, key.c_str(), key.size() + 1));
+      assert(record_key != nullptr);
+      uint64_t overwrite_seq = 0;
+      char * field = record_key;
+      while (overwrite_seq != 2 * NUM_OVERWRITES) {
+        field -= sizeof(uint64_t);
+        memcpy(&overwrite_seq, field, sizeof(overwrite_seq));
+      }
+      overwrite_seq += 1;
+      memcpy(field, &overwrite_seq, sizeof(overwrite_seq));
+      memset(record_key + key.size() + 1, '#', 8);
+      munmap(mapping, file_size);
+      close(fd);
+      // purposely leak hash_table to simulate process crash
+      _exit(0);
+    }
+    int status;
+    const pid_t waited = waitpid(pid, &status, 0);
+    assert(waited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // the torn record is quarantined rather than read back, the log redoes the overwrites at the versions they had
+    ConcurrentHashTable hash_table(options);
+    const std::pair<std::string, uint64_t> value = hash_table.get_versioned(key);
+    if (durability == ConcurrentHashTable::Durability::LOG) {
+      assert(value.first == value_of(NUM_OVERWRITES) && value.second == NUM_OVERWRITES + 1);
+    } else {
+      assert(value.first.empty());
+    }
+    assert(hash_table.quarantined_records().size() == 1);
+    const size_t num_reclaimed = hash_table.reclaim_quarantined_records();
+    assert(num_reclaimed == 1);
+    assert(hash_table.quarantined_records().empty());
+    const bool written = hash_table.put(key, value_of(0));
+    assert(written);
+  }
+  std::cout << '\n';
+}
+
+// a process that dies part way through writing a new record, before its commit finished
+void test_torn_new_record()
+{
+  const std::string key = "torn_new_key";
+  unlink(TORN_STORE_FILENAME);
+  ConcurrentHashTable::Options options;
+  options.path = TORN_STORE_FILENAME;
+  options.buffer_size = 4194304;
+  options.expected_keys = 1000;
+  options.durability = ConcurrentHashTable::Durability::NONE;
+
+  std::cout.flush();
+  const pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    ConcurrentHashTable * hash_table = new ConcurrentHashTable(options);
+    const bool committed = hash_table->put("committed_key", "committed_value");
+    const bool written = hash_table->put(key, "value that never made it");
+    assert(committed && written);
+
+    // the version of a new key is 1, and two fields after its commit_seq. put the record back to how the allocator left
+    // it, with commit_seq 0, and tear the value as a crash in the middle of writing it would
+    const int fd = open(TORN_STORE_FILENAME, O_RDWR);
+    assert(fd >= 0);
+    const off_t file_size = lseek(fd, 0, SEEK_END);
+    char * mapping = static_cast<char *>(mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    assert(mapping != MAP_FAILED);
+    char * record_key = static_cast<char *>(memmem(mapping, file_size, key.c_str(), key.size() + 1));
+    assert(record_key != nullptr);
+    uint64_t version = 0;
+    char * field = record_key;
+    while (version != 1) {
+      field -= sizeof(uint64_t);
+      memcpy(&version, field, sizeof(version));
+    }
+    memset(field - 2 * sizeof(uint64_t), 0, sizeof(uint64_t));
+    memset(record_key + key.size() + 1, '#', 8);
+    munmap(mapping, file_size);
+    close(fd);
+    // purposely leak hash_table to simulate process crash
+    _exit(0);
+  }
+  int status;
+  const pid_t waited = waitpid(pid, &status, 0);
+  assert(waited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  // the record is freed with the rest of the unfinished commit, not quarantined as torn
+  ConcurrentHashTable hash_table(options);
+  assert(hash_table.get(key).empty());
+  assert(hash_table.get("committed_key") == "committed_value");
+  assert(hash_table.quarantined_records().empty());
+  std::cout << '\n';
+}
+
+void test_record_checksums(ConcurrentHashTable * hash_table)
+{
+  // the check value of CRC-32C, and the hardware and table versions agreeing on a longer, continued checksum
+  assert(crc32c("123456789", 9) == 0xe3069283);
+  assert(crc32c_software("123456789", 9) == 0xe3069283);
+  std::string data(1000, '\0');
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i * 37 + 11);
+  }
+  assert(crc32c(data.data(), data.size()) == crc32c_software(data.data(), data.size()));
+  assert(crc32c(data.data() + 333, data.size() - 333, crc32c(data.data(), 333)) == crc32c(data.data(), data.size()));
+
+  const std::string key = "checksum_key";
+  const std::string value = "checksummed value of process " + std::to_string(getpid()) + " at " + std::to_string(time(nullptr));
+  const bool written = hash_table->put(key, value);
+  assert(written);
+  hash_table->set_verify_reads(true);
+  assert(hash_table->get(key) == value);
+
+  // corrupt the record through a second mapping of the store file, reads must not return it
+  const int fd = open(ConcurrentHashTable::BUFFER_FILENAME, O_RDWR);
+  assert(fd >= 0);
+  const off_t file_size = lseek(fd, 0, SEEK_END);
+  char * mapping = static_cast<char *>(mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+  assert(mapping != MAP_FAILED);
+  char * value_data = static_cast<char *>(memmem(mapping, file_size, value.data(), value.size()));
+  assert(value_data != nullptr);
+  value_data[0] ^= 0x20;
+  assert(hash_table->get(key).empty());
+  value_data[0] ^= 0x20;
+  assert(hash_table->get(key) == value);
+  munmap(mapping, file_size);
+  close(fd);
+
+  hash_table->set_verify_reads(false);
+  hash_table->print_stats();
+}
+
+void test_checkpoint(ConcurrentHashTable * hash_table)
+{
+  // writers keep going while the copy is taken
+  constexpr size_t NUM_WRITERS = 4;
+  std::atomic<bool> done(false);
+  std::vector<std::thread> threads; threads.reserve(NUM_WRITERS);
+  for (size_t i = 0; i < NUM_WRITERS; ++i) {
+    threads.emplace_back([hash_table, &done, i]() -> void {
+      for (size_t j = 0; !done; ++j) {
+        const std::string key = "checkpoint_key" + std::to_string(i) + "_" + std::to_string(j % 500);
+        const bool written = hash_table->put(key, std::string(j % 200 + 1, 'a' + j % 26));
+        assert(written);
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  const bool success = hash_table->checkpoint_to(CHECKPOINT_FILENAME);
+  done = true;
+  for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+    iter->join();
+  }
+  assert(success);
+
+  // the copy's block headers, used list and free list must agree with each other
+  FileBackedBuffer copy(CHECKPOINT_FILENAME, 0);
+  size_t num_used = 0;
+  for (auto iter = copy.begin_used(); iter != copy.end_used(); ++iter) {
+    ++num_used;
+  }
+  const std::vector<uint8_t *> scanned = copy.scan_used();
+  assert(scanned.size() == num_used);
+  // ranges stepped through by several threads have to come to the same blocks
+  const std::vector<uint8_t *> scanned_in_parallel = copy.scan_used(8);
+  assert(scanned_in_parallel == scanned);
+  assert(copy.list_used().size() == num_used);
+  std::cout << "checkpoint copy has " << num_used << " used blocks\n\n";
+  hash_table->print_stats();
+}
+
+size_t file_size(const std::string & filename)
+{
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  return file.tellg();
+}
+
+bool files_equal(const std::string & filename1, const std::string & filename2)
+{
+  std::ifstream file1(filename1, std::ios::binary);
+  std::ifstream file2(filename2, std::ios::binary);
+  std::vector<char> buffer1(1 << 20);
+  std::vector<char> buffer2(buffer1.size());
+  while (file1 && file2) {
+    file1.read(buffer1.data(), buffer1.size());
+    file2.read(buffer2.data(), buffer2.size());
+    if (file1.gcount() != file2.gcount() || memcmp(buffer1.data(), buffer2.data(), file1.gcount()) != 0) {
+      return false;
+    }
+  }
+  return file1.eof() && file2.eof();
+}
+
+void test_incremental_backup(ConcurrentHashTable * hash_table)
+{
+  // the first backup into the directory is a whole copy, the rest only hold the pages written in between
+  std::vector<std::string> backups = {"base.bin"};
+  const bool backed_up = hash_table->backup_to(BACKUP_DIRECTORY);
+  assert(backed_up);
+  for (size_t i = 1; i <= 2; ++i) {
+    for (size_t j = 0; j < 100; ++j) {
+      const std::string key = "backup_key" + std::to_string(j);
+      const bool written = hash_table->put(key, std::string(j + 1, '0' + i));
+      assert(written);
+    }
+    int64_t previous_value;
+    const bool added = hash_table->fetch_add("atomic_counter", 1, previous_value);
+    const bool backed_up_delta = hash_table->backup_to(BACKUP_DIRECTORY);
+    assert(added && backed_up_delta);
+    std::ostringstream delta;
+    delta << "delta-" << std::setw(6) << std::setfill('0') << i << ".bin";
+    backups.push_back(delta.str());
+  }
+
+  const size_t base_size = file_size(std::string(BACKUP_DIRECTORY) + "/" + backups[0]);
+  for (size_t i = 1; i < backups.size(); ++i) {
+    const size_t delta_size = file_size(std::string(BACKUP_DIRECTORY) + "/" + backups[i]);
+    std::cout << backups[i] << " is " << delta_size << " bytes, " << backups[0] << " is " << base_size << " bytes\n";
+    assert(delta_size > 0 && delta_size < base_size / 10);
+  }
 
-  // purposely leak hash_table to simulate process crash
+  // nothing was written since the last backup, so the chain restores the store file as it is now
+  unlink(RESTORED_FILENAME);
+  const bool restored = ConcurrentHashTable::restore_backup(BACKUP_DIRECTORY, RESTORED_FILENAME);
+  assert(restored);
+  assert(files_equal(RESTORED_FILENAME, ConcurrentHashTable::BUFFER_FILENAME));
+  std::cout << '\n';
+}
+
+size_t count_key_value_pairs(const ConcurrentHashTable * hash_table)
+{
+  size_t count = 0;
+  for (auto iter = hash_table->begin(); iter != hash_table->end(); ++iter) {
+    ++count;
+  }
+  return count;
+}
+
+// run by test_handoff() in a child process, in place of the next version of the process
+int take_over_store(const int socket_fd, const size_t expected_size, const std::string & expected_counter_value)
+{
+  std::unique_ptr<ConcurrentHashTable> hash_table = ConcurrentHashTable::take_over(socket_fd, ConcurrentHashTable::Durability::LOG);
+  assert(hash_table != nullptr);
+  assert(hash_table->index_loaded());
+  assert(count_key_value_pairs(hash_table.get()) == expected_size);
+  assert(hash_table->get("atomic_counter") == expected_counter_value);
+  const bool written = hash_table->put("handoff_key", "written by the successor");
+  assert(written);
+  return 0;
+}
+
+ConcurrentHashTable * test_handoff(ConcurrentHashTable * hash_table)
+{
+  // a handoff that fails leaves the table as it was, without the index snapshot it saved
+  const bool handed_off_to_nothing = hash_table->hand_off(-1);
+  assert(!handed_off_to_nothing);
+  const bool written = hash_table->put("failed_handoff_key", "still writable");
+  assert(written);
+  assert(hash_table->get("failed_handoff_key") == "still writable");
+
+  const std::string expected_size = std::to_string(count_key_value_pairs(hash_table));
+  const std::string counter_value = hash_table->get("atomic_counter");
+
+  int sockets[2];
+  const int paired = socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+  assert(paired == 0);
+  const std::string socket_fd = std::to_string(sockets[1]);
+  std::cout.flush();
+  const pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    close(sockets[0]);
+    execl("/proc/self/exe", "basic_test", "--take-over", socket_fd.c_str(), expected_size.c_str(), counter_value.c_str(), nullptr);
+    _exit(127);
+  }
+  close(sockets[1]);
+
+  const bool handed_off = hash_table->hand_off(sockets[0]);
+  assert(handed_off);
+  close(sockets[0]);
+  delete hash_table;
+
+  int status;
+  const pid_t waited = waitpid(pid, &status, 0);
+  assert(waited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  // the successor saved the index at its own clean shutdown
+  hash_table = new ConcurrentHashTable(ConcurrentHashTable::Durability::LOG);
+  assert(hash_table->index_loaded());
+  assert(hash_table->get("handoff_key") == "written by the successor");
+  return hash_table;
+}
+
+void test_fixed_size_hash_table()
+{
+  struct Point {
+    uint64_t x;
+    uint64_t y;
+  };
+  constexpr size_t NUM_THREADS = 8;
+  constexpr uint64_t NUM_KEYS = 10000;
+  size_t size;
+  {
+    FixedSizeHashTable<uint64_t, Point> table(FIXED_SIZE_BUFFER_FILENAME, 100000);
+
+    std::vector<std::thread> threads; threads.reserve(NUM_THREADS);
+    for (size_t i = 0; i < NUM_THREADS; ++i) {
+      threads.emplace_back([&table, i]() -> void {
+        for (uint64_t key = 0; key < NUM_KEYS; ++key) {
+          if (key % NUM_THREADS == i) {
+            const bool success = table.put(key, Point{key, 2 * key});
+            assert(success);
+          } else {
+            Point point;
+            if (table.get(key, point)) {
+              assert(point.x == key && point.y == 2 * key);
+            }
+          }
+        }
+      });
+    }
+    for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+      iter->join();
+    }
+
+    for (uint64_t key = 0; key < NUM_KEYS; ++key) {
+      Point point;
+      const bool found = table.get(key, point);
+      assert(found && point.x == key && point.y == 2 * key);
+    }
+    Point point;
+    const bool found_missing = table.get(NUM_KEYS, point);
+    assert(!found_missing);
+
+    // overwrites alternate between a slot's two copies of its value, readers must only ever see whole values
+    std::atomic<bool> done(false);
+    std::thread reader([&table, &done]() -> void {
+      while (!done) {
+        Point point;
+        const bool found = table.get(0, point);
+        assert(found && point.y == 2 * point.x);
+      }
+    });
+    for (uint64_t i = 1; i <= 1000; ++i) {
+      const bool written = table.put(0, Point{i, 2 * i});
+      assert(written);
+    }
+    done = true;
+    reader.join();
+    const bool written = table.put(0, Point{0, 0});
+    assert(written);
+
+    size = table.size();
+    table.print_stats();
+  }
+
+  // the size is counted again when the table is opened, and what was written made it to the file when it was closed
+  FixedSizeHashTable<uint64_t, Point> table(FIXED_SIZE_BUFFER_FILENAME, 100000);
+  assert(table.size() == size);
+  Point point;
+  const bool found_first = table.get(0, point);
+  assert(found_first && point.x == 0 && point.y == 0);
+  const bool found_last = table.get(NUM_KEYS - 1, point);
+  assert(found_last && point.x == NUM_KEYS - 1 && point.y == 2 * (NUM_KEYS - 1));
+  const bool synced = table.sync();
+  assert(synced);
+}
+
+// a clean shutdown saves the index, which the next open loads instead of rebuilding it from the records
+ConcurrentHashTable * test_clean_restart(ConcurrentHashTable * hash_table)
+{
+  std::map<std::string, std::string> contents;
+  for (auto iter = hash_table->begin(); iter != hash_table->end(); ++iter) {
+    contents.insert(*iter);
+  }
+  const std::string counter_value = hash_table->get("atomic_counter");
+  delete hash_table;
+
+  // lookups made while the log is still being redone in the background wait for it
+  hash_table = new ConcurrentHashTable(ConcurrentHashTable::Durability::LOG, ConcurrentHashTable::Recovery::BACKGROUND);
+  assert(hash_table->get("atomic_counter") == counter_value);
+  assert(hash_table->index_loaded());
+  std::map<std::string, std::string> reloaded_contents;
+  for (auto iter = hash_table->begin(); iter != hash_table->end(); ++iter) {
+    reloaded_contents.insert(*iter);
+  }
+  assert(reloaded_contents == contents);
+  for (const auto & key_value_pair : contents) {
+    assert(hash_table->get(key_value_pair.first) == key_value_pair.second);
+  }
+  int64_t previous_value;
+  const bool added = hash_table->fetch_add("atomic_counter", 1, previous_value);
+  assert(added && std::to_string(previous_value) == counter_value);
+
+  hash_table->print_stats();
+  return hash_table;
+}
+
+// an index snapshot damaged after the shutdown that saved it is noticed, and the index rebuilt instead
+void test_damaged_index_snapshot()
+{
+  constexpr size_t NUM_KEYS = 100;
+  unlink(SNAPSHOT_STORE_FILENAME);
+  ConcurrentHashTable::Options options;
+  options.path = SNAPSHOT_STORE_FILENAME;
+  options.buffer_size = 4194304;
+  options.expected_keys = 1000;
+  {
+    ConcurrentHashTable hash_table(options);
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+      const bool success = hash_table.put("snapshot_key" + std::to_string(i), std::to_string(i));
+      assert(success);
+    }
+  }
+
+  // flip a bit in the last node, past the header, which starts with the snapshot's magic "ktidx002"
+  const int fd = open(SNAPSHOT_STORE_FILENAME, O_RDWR);
+  assert(fd >= 0);
+  const off_t file_size = lseek(fd, 0, SEEK_END);
+  char * mapping = static_cast<char *>(mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+  assert(mapping != MAP_FAILED);
+  char * snapshot = static_cast<char *>(memmem(mapping, file_size, "ktidx002", 8));
+  assert(snapshot != nullptr);
+  uint64_t num_nodes;
+  memcpy(&num_nodes, snapshot + 4 * sizeof(uint64_t), sizeof(num_nodes));
+  assert(num_nodes == NUM_KEYS);
+  snapshot[5 * sizeof(uint64_t) + (num_nodes - 1) * 16 + 9] ^= 0x40;
+  munmap(mapping, file_size);
+  close(fd);
+
+  ConcurrentHashTable hash_table(options);
+  assert(!hash_table.index_loaded());
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    assert(hash_table.get("snapshot_key" + std::to_string(i)) == std::to_string(i));
+  }
+  std::cout << '\n';
+}
+
+// a sparse store file past what an int can hold, so that sizes and offsets have to be 64-bit all the way through
+void test_large_store()
+{
+  constexpr size_t LARGE_BUFFER_SIZE = 3221225472;  // 3 GiB
+  static_assert(LARGE_BUFFER_SIZE > static_cast<size_t>(INT_MAX) + 1, "the store has to be bigger than INT_MAX");
+  unlink(LARGE_STORE_FILENAME);
+  unlink(ConcurrentHashTable::log_path_of(LARGE_STORE_FILENAME).c_str());
+
+  FileByteOffset offset;
+  size_t size;
+  {
+    FileBackedBuffer buffer(LARGE_STORE_FILENAME, LARGE_BUFFER_SIZE);
+    assert(file_size(LARGE_STORE_FILENAME) == LARGE_BUFFER_SIZE);
+    uint8_t * block = buffer.alloc(LARGE_BUFFER_SIZE - 268435456);
+    assert(block != nullptr);
+    offset = buffer.offset_of(block);
+    size = buffer.size_of(block);
+    assert(offset + size > static_cast<size_t>(INT_MAX));
+    block[size - 1] = 0x5a;
+    buffer.mark_dirty(block + size - 1, 1);
+    const bool synced = buffer.sync();
+    assert(synced);
+  }
+  {
+    FileBackedBuffer buffer(LARGE_STORE_FILENAME, LARGE_BUFFER_SIZE);
+    assert(buffer.pointer_at(offset)[size - 1] == 0x5a);
+  }
+  unlink(LARGE_STORE_FILENAME);
+
+  // and sized through the table's options
+  ConcurrentHashTable::Options options;
+  options.path = LARGE_STORE_FILENAME;
+  options.buffer_size = LARGE_BUFFER_SIZE;
+  {
+    ConcurrentHashTable hash_table(options);
+    const bool written = hash_table.put("large_store_key", "large_store_value");
+    assert(written);
+  }
+  assert(file_size(LARGE_STORE_FILENAME) == LARGE_BUFFER_SIZE);
+  ConcurrentHashTable hash_table(options);
+  assert(hash_table.get("large_store_key") == "large_store_value");
+}
+
+size_t disk_usage(const int fd)
+{
+  struct stat stat_buf;
+  const int result = fstat(fd, &stat_buf);
+  assert(result == 0);
+  return stat_buf.st_blocks * 512;
+}
+
+void test_hole_punching()
+{
+  unlink(TEST_BUFFER_FILENAME);
+
+  constexpr size_t LARGE_SIZE = 4194304;
+  FileBackedBuffer buffer(TEST_BUFFER_FILENAME, 16777216);
+  uint8_t * small = buffer.alloc(64);
+  uint8_t * large = buffer.alloc(LARGE_SIZE);
+  uint8_t * after = buffer.alloc(64);
+  assert(small != nullptr && large != nullptr && after != nullptr);
+  memfill(small, 64, 0xDEADBEEF);
+  memfill(large, LARGE_SIZE, 0xBA5EBA11);
+  memfill(after, 64, 0xDEADBEEF);
+  buffer.mark_dirty(small, 64);
+  buffer.mark_dirty(large, LARGE_SIZE);
+  buffer.mark_dirty(after, 64);
+  const bool synced = buffer.sync();
+  assert(synced);
+  const size_t used_disk = disk_usage(buffer.fd());
+
+  // the freed block's disk space is returned, its neighbours are left alone
+  buffer.free(large);
+  const size_t num_punched_bytes = buffer.punch_holes();
+  const size_t freed_disk = used_disk - disk_usage(buffer.fd());
+  std::cout << "punched " << num_punched_bytes << " bytes, disk usage went down by " << freed_disk << " bytes\n";
+  assert(num_punched_bytes > LARGE_SIZE - 2 * 4096 && num_punched_bytes <= LARGE_SIZE);
+  assert(freed_disk >= num_punched_bytes / 2);
+  for (const uint8_t * pointer : {small, after}) {
+    uint8_t expected[64];
+    memfill(expected, 64, 0xDEADBEEF);
+    assert(memcmp(pointer, expected, 64) == 0);
+  }
+
+  // a block freed and then allocated from again before the holes are punched keeps its contents
+  uint8_t * reused = buffer.alloc(LARGE_SIZE);
+  assert(reused != nullptr);
+  memfill(reused, LARGE_SIZE, 0xC0FFEE00);
+  uint8_t * other = buffer.alloc(LARGE_SIZE);
+  assert(other != nullptr);
+  buffer.free(other);
+  buffer.free(reused);
+  reused = buffer.alloc(LARGE_SIZE);
+  memfill(reused, LARGE_SIZE, 0xC0FFEE00);
+  buffer.punch_holes();
+  std::vector<uint8_t> expected(LARGE_SIZE);
+  memfill(expected.data(), LARGE_SIZE, 0xC0FFEE00);
+  assert(memcmp(reused, expected.data(), LARGE_SIZE) == 0);
+
+  // pausing the background work, as before a handoff, punches what was queued rather than leaving it for later
+  buffer.free(reused);
+  buffer.pause_background_work();
+  const size_t num_left_over_bytes = buffer.punch_holes();
+  assert(num_left_over_bytes == 0);
+  buffer.resume_background_work();
+  buffer.print_stats();
+}
+
+void test_residency()
+{
+  unlink(TEST_BUFFER_FILENAME);
+
+  constexpr size_t LARGE_SIZE = 1048576;
+  FileBackedBuffer buffer(TEST_BUFFER_FILENAME, 16777216);
+  uint8_t * root = buffer.alloc_root(64);
+  uint8_t * large = buffer.alloc(LARGE_SIZE);
+  assert(root != nullptr && large != nullptr);
+  memfill(large, LARGE_SIZE, 0xBA5EBA11);
+  buffer.mark_dirty(large, LARGE_SIZE);
+
+  // every policy at once, with the background thread started and then stopped by the next change of policy
+  FileBackedBuffer::Residency residency;
+  residency.warm_up = FileBackedBuffer::Residency::WarmUp::BACKGROUND;
+  residency.prefetch_large_reads = true;
+  residency.cold_after = std::chrono::minutes(1);
+  residency.lock_metadata = true;
+  buffer.set_residency(residency);
+  buffer.prepare_read(large, LARGE_SIZE);
+  residency = FileBackedBuffer::Residency();
+  residency.warm_up = FileBackedBuffer::Residency::WarmUp::POPULATE;
+  buffer.set_residency(residency);
+
+  std::vector<uint8_t> expected(LARGE_SIZE);
+  memfill(expected.data(), LARGE_SIZE, 0xBA5EBA11);
+  assert(memcmp(large, expected.data(), LARGE_SIZE) == 0);
+  buffer.print_stats();
+}
+
+void test_volatile_store()
+{
+  constexpr size_t NUM_KEYS = 1000;
+  ConcurrentHashTable * hash_table = new ConcurrentHashTable(ConcurrentHashTable::Durability::VOLATILE);
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    const bool written = hash_table->put("volatile_key" + std::to_string(i), std::to_string(i));
+    assert(written);
+  }
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    assert(hash_table->get("volatile_key" + std::to_string(i)) == std::to_string(i));
+  }
+  int64_t previous_value;
+  const bool added = hash_table->fetch_add("volatile_counter", 5, previous_value);
+  assert(added && previous_value == 0);
+  assert(count_key_value_pairs(hash_table) == NUM_KEYS + 1);
+  hash_table->print_stats();
+  delete hash_table;
+
+  // nothing outlives the table
+  hash_table = new ConcurrentHashTable(ConcurrentHashTable::Durability::VOLATILE);
+  assert(count_key_value_pairs(hash_table) == 0);
+  assert(hash_table->get("volatile_key0").empty());
+  delete hash_table;
+}
+
+void test_multiple_stores()
+{
+  unlink(SMALL_STORE_FILENAME);
+  unlink(LARGE_STORE_FILENAME);
+  unlink(ConcurrentHashTable::log_path_of(LARGE_STORE_FILENAME).c_str());
+  assert(ConcurrentHashTable::log_path_of(LARGE_STORE_FILENAME) == "kvtest.large.wal");
+  assert(ConcurrentHashTable::log_path_of("kvtest") == "kvtest.wal");
+  assert(ConcurrentHashTable::index_size_for(200000) == 266671);
+
+  ConcurrentHashTable::Options small_options;
+  small_options.path = SMALL_STORE_FILENAME;
+  small_options.buffer_size = 4194304;
+  small_options.expected_keys = 1000;
+  small_options.allocator.punch_hole_min_size = 0;
+  ConcurrentHashTable::Options large_options;
+  large_options.path = LARGE_STORE_FILENAME;
+  large_options.buffer_size = 67108864;
+  large_options.expected_keys = 20000;
+  large_options.durability = ConcurrentHashTable::Durability::LOG;
+
+  // the same keys in both, open at the same time
+  constexpr size_t NUM_KEYS = 1000;
+  {
+    ConcurrentHashTable small_table(small_options);
+    ConcurrentHashTable large_table(large_options);
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+      const bool small_written = small_table.put("store_key" + std::to_string(i), "small" + std::to_string(i));
+      const bool large_written = large_table.put("store_key" + std::to_string(i), "large" + std::to_string(i));
+      assert(small_written && large_written);
+    }
+    const bool written = large_table.put("large_only_key", "large_only_value");
+    assert(written);
+    assert(small_table.get("large_only_key").empty());
+    assert(count_key_value_pairs(&small_table) == NUM_KEYS);
+    assert(count_key_value_pairs(&large_table) == NUM_KEYS + 1);
+    small_table.print_stats();
+  }
+  assert(file_size(SMALL_STORE_FILENAME) == small_options.buffer_size);
+  assert(file_size(LARGE_STORE_FILENAME) == large_options.buffer_size);
+  assert(access(ConcurrentHashTable::log_path_of(LARGE_STORE_FILENAME).c_str(), F_OK) == 0);
+
+  // each reopens to its own contents
+  ConcurrentHashTable small_table(small_options);
+  ConcurrentHashTable large_table(large_options);
+  assert(small_table.index_loaded() && large_table.index_loaded());
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    assert(small_table.get("store_key" + std::to_string(i)) == "small" + std::to_string(i));
+    assert(large_table.get("store_key" + std::to_string(i)) == "large" + std::to_string(i));
+  }
+  assert(large_table.get("large_only_key") == "large_only_value");
+}
+
+void test_sharded_store()
+{
+  constexpr size_t NUM_SHARDS = 4;
+  for (size_t i = 0; i < NUM_SHARDS; ++i) {
+    unlink(ShardedStore::shard_path_of(SHARDED_STORE_FILENAME, i).c_str());
+    unlink(ConcurrentHashTable::log_path_of(ShardedStore::shard_path_of(SHARDED_STORE_FILENAME, i)).c_str());
+  }
+  unlink("kvtest.sharded.shards");
+  assert(ShardedStore::shard_path_of(SHARDED_STORE_FILENAME, 3) == "kvtest.sharded.3.bin");
+
+  ConcurrentHashTable::Options options;
+  options.path = SHARDED_STORE_FILENAME;
+  options.buffer_size = 4 * 16777216;
+  options.expected_keys = 10000;
+  options.durability = ConcurrentHashTable::Durability::LOG;
+
+  // writers on every shard at once
+  constexpr size_t NUM_THREADS = 8;
+  constexpr size_t NUM_PUTS_PER_THREAD = 500;
+  std::vector<std::string> keys;
+  {
+    ShardedStore store(NUM_SHARDS, options);
+    std::vector<std::thread> threads; threads.reserve(NUM_THREADS);
+    for (size_t i = 0; i < NUM_THREADS; ++i) {
+      threads.emplace_back([&store, i]() -> void {
+        for (size_t j = 0; j < NUM_PUTS_PER_THREAD; ++j) {
+          const std::string key = "sharded_key" + std::to_string(i) + "_" + std::to_string(j);
+          const bool written = store.put(key, key + "_value");
+          assert(written);
+        }
+      });
+    }
+    for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+      iter->join();
+    }
+    for (size_t i = 0; i < NUM_THREADS; ++i) {
+      for (size_t j = 0; j < NUM_PUTS_PER_THREAD; ++j) {
+        keys.push_back("sharded_key" + std::to_string(i) + "_" + std::to_string(j));
+      }
+    }
+
+    // every shard got some of the keys, and each key is only in its own shard
+    for (size_t i = 0; i < NUM_SHARDS; ++i) {
+      assert(count_key_value_pairs(&store.shard(i)) > 0);
+    }
+    for (size_t i = 0; i < keys.size(); i += 97) {
+      for (size_t j = 0; j < NUM_SHARDS; ++j) {
+        assert(store.shard(j).get(keys[i]).empty() == (j != store.shard_of(keys[i])));
+      }
+    }
+
+    const size_t num_written = store.put_batch({{"sharded_batch_a", "a"}, {"sharded_batch_b", "b"}, {"sharded_batch_c", "c"}},
+                                               ShardedStore::BatchMode::ALL_OR_NOTHING);
+    assert(num_written == 3);
+    int64_t previous_value;
+    const bool added = store.fetch_add("sharded_counter", 7, previous_value);
+    assert(added && previous_value == 0);
+    const std::vector<std::string> values = store.multi_get({keys[1], "sharded_batch_b", "sharded_missing", keys[2]});
+    assert(values[0] == keys[1] + "_value" && values[1] == "b" && values[2].empty() && values[3] == keys[2] + "_value");
+  }
+
+  // keys would be looked for in the wrong shards with any other number of them
+  bool reopened_with_other_shards = true;
+  try {
+    ShardedStore other_store(NUM_SHARDS + 1, options);
+  } catch (const std::runtime_error &) {
+    reopened_with_other_shards = false;
+  }
+  assert(!reopened_with_other_shards);
+
+  // iteration covers every shard, and the store reopens across all of them
+  ShardedStore store(NUM_SHARDS, options);
+  std::unordered_set<std::string> iterated_keys;
+  for (auto iter = store.begin(); iter != store.end(); ++iter) {
+    const bool inserted = iterated_keys.insert((*iter).first).second;
+    assert(inserted);
+  }
+  assert(iterated_keys.size() == keys.size() + 4);
+  for (const std::string & key : keys) {
+    assert(store.get(key) == key + "_value");
+  }
+  assert(store.get("sharded_counter") == "7");
+  store.print_stats();
+}
+
+void test_write_ahead_log()
+{
+  unlink(TEST_LOG_FILENAME);
+
+  constexpr size_t NUM_THREADS = 8;
+  constexpr size_t NUM_APPENDS = 100;
+  {
+    WriteAheadLog log(TEST_LOG_FILENAME);
+    std::vector<std::thread> threads; threads.reserve(NUM_THREADS);
+    for (size_t i = 0; i < NUM_THREADS; ++i) {
+      threads.emplace_back([&log, i]() -> void {
+        const std::string key = "log_key" + std::to_string(i);
+        for (size_t j = 0; j < NUM_APPENDS; ++j) {
+          const std::string value = std::to_string(j);
+          const bool synced = log.sync(log.append({{WriteAheadLog::EntryType::PUT, j + 1, key, value}}));
+          assert(synced);
+        }
+      });
+    }
+    for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+      iter->join();
+    }
+
+    // a unit of several entries, then a unit that is cut off part way through as if by a crash
+    log.append({{WriteAheadLog::EntryType::PUT, 1, "batch_key0", "a"}, {WriteAheadLog::EntryType::MERGE, 1, "batch_key1", "b"}});
+    const uint64_t lsn = log.append({{WriteAheadLog::EntryType::PUT, 1, "torn_key0", "c"}, {WriteAheadLog::EntryType::PUT, 1, "torn_key1", "d"}});
+    const bool synced = log.sync(lsn);
+    assert(synced);
+    log.print_stats();
+    std::unique_lock<std::mutex> log_lock = log.lock();
+    const int result = truncate(TEST_LOG_FILENAME, log.size() - 1);
+    assert(result == 0);
+  }
+
+  WriteAheadLog log(TEST_LOG_FILENAME);
+  std::vector<size_t> next_value(NUM_THREADS, 0);
+  size_t num_batch_entries = 0;
+  const size_t num_replayed = log.replay([&](const WriteAheadLog::Entry & entry) -> void {
+    assert(entry.key.substr(0, 4) != "torn");
+    if (entry.key.substr(0, 5) == "batch") {
+      ++num_batch_entries;
+      return;
+    }
+    // each thread's entries come back in the order they were appended
+    const size_t i = std::stoul(std::string(entry.key.substr(7)));
+    assert(entry.value == std::to_string(next_value[i]));
+    assert(entry.version == next_value[i] + 1);
+    ++next_value[i];
+  });
+  assert(num_replayed == NUM_THREADS * NUM_APPENDS + 2);
+  assert(num_batch_entries == 2);
+  assert(std::all_of(next_value.begin(), next_value.end(), [](const size_t value) { return value == NUM_APPENDS; }));
+
+  // the torn unit is gone, and new appends follow the last whole unit
+  log.append({{WriteAheadLog::EntryType::COUNTER, 1, "counter_key", "12345678"}});
+  const size_t num_replayed_again = log.replay([](const WriteAheadLog::Entry &) -> void {});
+  assert(num_replayed_again == num_replayed + 1);
+
+  std::unique_lock<std::mutex> log_lock = log.lock();
+  log.truncate();
+  assert(log.size() == 0);
+  log_lock.unlock();
+
+  // a failed append reports the failure rather than handing out a sequence number to wait for
+  WriteAheadLog full_log("/dev/full");
+  const uint64_t failed_lsn = full_log.append({{WriteAheadLog::EntryType::PUT, 1, "full_key", "value"}});
+  assert(failed_lsn == 0);
+  assert(full_log.size() == 0);
 }
 
 int main(const int argc, const char * argv[])
 {
-  if (argc >= 2) {
+  if (argc == 5 && strcmp(argv[1], "--take-over") == 0) {
+    return take_over_store(std::stoi(argv[2]), std::stoul(argv[3]), argv[4]);
+  } else if (argc >= 2) {
     assert(strcmp(argv[1], ConcurrentHashTable::BUFFER_FILENAME) != 0);
     test_buffer(argv[1]);
   } else {
-    test_hash_table();
+    test_write_ahead_log();
+    test_large_store();
+    test_hole_punching();
+    test_residency();
+    test_volatile_store();
+    test_multiple_stores();
+    test_sharded_store();
+
+    ConcurrentHashTable * hash_table = new ConcurrentHashTable(ConcurrentHashTable::Durability::LOG);
+    test_hash_table(hash_table);
+    test_write_batch(hash_table);
+    test_put_if_version(hash_table);
+    test_merge(hash_table);
+    test_merge_operator();
+    test_counters(hash_table);
+    test_overwrite_in_place(hash_table);
+    test_torn_overwrite();
+    test_torn_new_record();
+    test_record_checksums(hash_table);
+    test_checkpoint(hash_table);
+    test_incremental_backup(hash_table);
+    hash_table = test_clean_restart(hash_table);
+    test_damaged_index_snapshot();
+    hash_table = test_handoff(hash_table);
+    test_fixed_size_hash_table();
+    // purposely leak hash_table to simulate process crash
   }
 
   return 0;
@@ -0,0 +1,492 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <cstring>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "hash_table_impl.hpp"
+#include "sharded_store.hpp"
+
+constexpr size_t NUM_KEYS = 100000;
+constexpr size_t VALUE_LENGTH = 32;
+constexpr char SHARDED_STORE_FILENAME[] = "kvshards.bin";
+constexpr char POLICY_STORE_FILENAME[] = "kvbench.bin";
+constexpr size_t NUM_LOOKUPS_PER_RUN = 1 << 20;  // total keys looked up per batch size, so each run does the same work
+
+std::string make_key(const size_t i)
+{
+  return "bench_key" + std::to_string(i);
+}
+
+void populate(ConcurrentHashTable * hash_table)
+{
+  std::cout << "Populating " << NUM_KEYS << " keys...\n";
+  const std::string value(VALUE_LENGTH, 'v');
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    const std::string key = make_key(i);
+    if (hash_table->get(key).empty()) {
+      hash_table->put(key, value);
+    }
+  }
+}
+
+volatile size_t hash_sink;  // keeps the hashing from being optimized away
+
+template <typename HashPolicy>
+double time_hash_policy(const std::vector<std::string> & keys)
+{
+  const HashPolicy hasher;
+  size_t checksum = 0;
+  const auto start_time = std::chrono::steady_clock::now();
+  for (size_t run = 0; run < NUM_LOOKUPS_PER_RUN / keys.size(); ++run) {
+    for (const std::string & key : keys) {
+      checksum += hasher(key);
+    }
+  }
+  const std::chrono::duration<double, std::nano> hash_time = std::chrono::steady_clock::now() - start_time;
+  hash_sink = checksum;
+  return hash_time.count() / static_cast<double>(NUM_LOOKUPS_PER_RUN / keys.size() * keys.size());
+}
+
+// the hash policies that BasicConcurrentHashTable can be instantiated with
+void benchmark_hash_policies()
+{
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    keys.push_back(make_key(i));
+  }
+
+  const double std_hash_time = time_hash_policy<StdHash>(keys);
+  const double fnv1a_hash_time = time_hash_policy<Fnv1aHash>(keys);
+  std::cout << "\nhash policies:\n"
+            << std::setw(12) << "StdHash" << std::setw(12) << std::fixed << std::setprecision(1) << std_hash_time << " ns/key\n"
+            << std::setw(12) << "Fnv1aHash" << std::setw(12) << fnv1a_hash_time << " ns/key\n"
+            << std::defaultfloat << std::setprecision(6);
+}
+
+// put() of values of varying sizes over a small set of keys, so that records are freed and reallocated all the time,
+// with readers getting random keys alongside. returns the time per put() and per get(), in ns
+template <typename HashTable>
+std::pair<double, double> time_policy_configuration()
+{
+  constexpr size_t NUM_POLICY_KEYS = 10000;
+  constexpr size_t NUM_PUTS = 200000;
+  constexpr size_t NUM_READERS = 3;
+
+  unlink(POLICY_STORE_FILENAME);
+  typename HashTable::Options options;
+  options.path = POLICY_STORE_FILENAME;
+  options.buffer_size = 67108864;
+  options.expected_keys = NUM_POLICY_KEYS;
+  HashTable * hash_table = new HashTable(options);
+  for (size_t i = 0; i < NUM_POLICY_KEYS; ++i) {
+    hash_table->put(make_key(i), std::string(VALUE_LENGTH, 'p'));
+  }
+
+  std::atomic<bool> done(false);
+  std::atomic<size_t> num_gets(0);
+  std::vector<std::thread> readers; readers.reserve(NUM_READERS);
+  for (size_t i = 0; i < NUM_READERS; ++i) {
+    readers.emplace_back([hash_table, &done, &num_gets, i]() -> void {
+      std::mt19937_64 generator(i);
+      size_t num_reader_gets = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        hash_table->get(make_key(generator() % NUM_POLICY_KEYS));
+        ++num_reader_gets;
+      }
+      num_gets += num_reader_gets;
+    });
+  }
+
+  std::mt19937_64 generator(0);
+  const auto start_time = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < NUM_PUTS; ++i) {
+    hash_table->put(make_key(generator() % NUM_POLICY_KEYS), std::string(16 + generator() % 496, 'p'));
+  }
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start_time;
+  done = true;
+  for (auto iter = readers.begin(); iter != readers.end(); ++iter) {
+    iter->join();
+  }
+
+  delete hash_table;
+  unlink(POLICY_STORE_FILENAME);
+  return std::make_pair(elapsed.count() / NUM_PUTS, elapsed.count() * NUM_READERS / std::max<size_t>(num_gets, 1));
+}
+
+// the allocator and reclamation policies that BasicConcurrentHashTable can be instantiated with, each against the
+// default configuration
+void benchmark_allocator_and_reclamation_policies()
+{
+  const std::vector<std::pair<const char *, std::pair<double, double>>> results = {
+    {"FileBackedBuffer, SharedPtrReclamation", time_policy_configuration<ConcurrentHashTable>()},
+    {"SizeClassBuffer, SharedPtrReclamation", time_policy_configuration<BasicConcurrentHashTable<StdHash, SizeClassBuffer>>()},
+    {"FileBackedBuffer, SpinlockSharedPtrReclamation",
+     time_policy_configuration<BasicConcurrentHashTable<StdHash, FileBackedBuffer, SpinlockSharedPtrReclamation>>()},
+  };
+
+  std::cout << "\nallocator and reclamation policies, put() of varying sizes with concurrent get()s:\n";
+  for (const auto & result : results) {
+    std::cout << std::setw(50) << result.first << std::fixed << std::setprecision(1)
+              << std::setw(12) << result.second.first << " ns/put" << std::setw(12) << result.second.second << " ns/get\n";
+  }
+  std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void benchmark_multi_get(ConcurrentHashTable * hash_table)
+{
+  std::mt19937 generator;
+  std::uniform_int_distribution<size_t> random_key(0, NUM_KEYS - 1);
+
+  std::cout << "\nmulti_get() vs looped get() (" << NUM_LOOKUPS_PER_RUN << " lookups per batch size):\n"
+            << std::setw(12) << "batch size" << std::setw(16) << "get (ns/key)" << std::setw(22) << "multi_get (ns/key)"
+            << std::setw(12) << "speedup" << '\n';
+
+  for (size_t batch_size = 1; batch_size <= 256; batch_size *= 2) {
+    const size_t num_batches = NUM_LOOKUPS_PER_RUN / batch_size;
+
+    std::vector<std::vector<std::string>> batches(num_batches);
+    for (auto & batch : batches) {
+      batch.reserve(batch_size);
+      for (size_t i = 0; i < batch_size; ++i) {
+        batch.push_back(make_key(random_key(generator)));
+      }
+    }
+
+    size_t num_found = 0;
+    auto start_time = std::chrono::steady_clock::now();
+    for (const auto & batch : batches) {
+      for (const std::string & key : batch) {
+        num_found += !hash_table->get(key).empty();
+      }
+    }
+    const std::chrono::duration<double, std::nano> get_time = std::chrono::steady_clock::now() - start_time;
+
+    size_t num_multi_found = 0;
+    start_time = std::chrono::steady_clock::now();
+    for (const auto & batch : batches) {
+      const std::vector<std::string> values = hash_table->multi_get(batch);
+      for (const std::string & value : values) {
+        num_multi_found += !value.empty();
+      }
+    }
+    const std::chrono::duration<double, std::nano> multi_get_time = std::chrono::steady_clock::now() - start_time;
+
+    if (num_found != num_multi_found) {
+      std::cerr << "[ERROR] get() found " << num_found << " keys but multi_get() found " << num_multi_found << '\n';
+    }
+
+    const double num_lookups = static_cast<double>(num_batches * batch_size);
+    std::cout << std::setw(12) << batch_size
+              << std::setw(16) << std::fixed << std::setprecision(1) << get_time.count() / num_lookups
+              << std::setw(22) << multi_get_time.count() / num_lookups
+              << std::setw(11) << std::setprecision(2) << get_time.count() / multi_get_time.count() << "x\n";
+  }
+  std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+// put() latency in each durability mode, with concurrent writers that can share syncs
+void benchmark_durability()
+{
+  constexpr size_t NUM_THREADS = 4;
+  constexpr size_t NUM_PUTS_PER_THREAD = 2000;
+  const std::vector<std::pair<ConcurrentHashTable::Durability, const char *>> modes = {
+    {ConcurrentHashTable::Durability::NONE, "NONE"},
+    {ConcurrentHashTable::Durability::PERIODIC, "PERIODIC"},
+    {ConcurrentHashTable::Durability::SYNC, "SYNC"},
+    {ConcurrentHashTable::Durability::LOG, "LOG"},
+    {ConcurrentHashTable::Durability::VOLATILE, "VOLATILE"},
+  };
+
+  std::vector<double> put_times;
+  for (const auto & mode : modes) {
+    ConcurrentHashTable * hash_table = new ConcurrentHashTable(mode.first);
+    const std::string value(VALUE_LENGTH, 'd');
+
+    const auto start_time = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads; threads.reserve(NUM_THREADS);
+    for (size_t i = 0; i < NUM_THREADS; ++i) {
+      threads.emplace_back([hash_table, &value, i]() -> void {
+        for (size_t j = 0; j < NUM_PUTS_PER_THREAD; ++j) {
+          hash_table->put("durability_key" + std::to_string(i) + "_" + std::to_string(j), value);
+        }
+      });
+    }
+    for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+      iter->join();
+    }
+    const std::chrono::duration<double, std::micro> put_time = std::chrono::steady_clock::now() - start_time;
+
+    put_times.push_back(put_time.count() / (NUM_THREADS * NUM_PUTS_PER_THREAD));
+    delete hash_table;
+  }
+
+  std::cout << "\nput() with " << NUM_THREADS << " writers in each durability mode:\n";
+  for (size_t i = 0; i < modes.size(); ++i) {
+    std::cout << std::setw(12) << modes[i].second << std::setw(12) << std::fixed << std::setprecision(1) << put_times[i] << " us/put\n";
+  }
+  std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void remove_sharded_store(const size_t num_shards)
+{
+  for (size_t i = 0; i < num_shards; ++i) {
+    const std::string shard_path = ShardedStore::shard_path_of(SHARDED_STORE_FILENAME, i);
+    unlink(shard_path.c_str());
+    unlink(ConcurrentHashTable::log_path_of(shard_path).c_str());
+  }
+  unlink("kvshards.shards");
+}
+
+// put() throughput with many writers as the keys are spread over more shards, each with its own write lock and files
+void benchmark_sharding()
+{
+  const size_t num_threads = std::max<size_t>(8, std::thread::hardware_concurrency());
+  const std::vector<std::pair<ConcurrentHashTable::Durability, size_t>> modes = {
+    {ConcurrentHashTable::Durability::NONE, 20000},
+    {ConcurrentHashTable::Durability::LOG, 1000},
+  };
+  const std::vector<size_t> shard_counts = {1, 2, 4, 8};
+
+  std::vector<std::vector<double>> put_rates(shard_counts.size());
+  for (size_t s = 0; s < shard_counts.size(); ++s) {
+    const size_t num_shards = shard_counts[s];
+    for (const auto & mode : modes) {
+      remove_sharded_store(num_shards);
+      ConcurrentHashTable::Options options;
+      options.path = SHARDED_STORE_FILENAME;
+      options.expected_keys = num_threads * mode.second;
+      options.durability = mode.first;
+      ShardedStore * store = new ShardedStore(num_shards, options);
+      const std::string value(VALUE_LENGTH, 's');
+
+      const size_t num_puts_per_thread = mode.second;
+      const auto start_time = std::chrono::steady_clock::now();
+      std::vector<std::thread> threads; threads.reserve(num_threads);
+      for (size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back([store, &value, i, num_puts_per_thread]() -> void {
+          for (size_t j = 0; j < num_puts_per_thread; ++j) {
+            store->put("sharded_key" + std::to_string(i) + "_" + std::to_string(j), value);
+          }
+        });
+      }
+      for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+        iter->join();
+      }
+      const std::chrono::duration<double> put_time = std::chrono::steady_clock::now() - start_time;
+
+      put_rates[s].push_back((num_threads * num_puts_per_thread) / put_time.count());
+      delete store;
+      remove_sharded_store(num_shards);
+    }
+  }
+
+  std::cout << "\nput() throughput with " << num_threads << " writers, by number of shards:\n"
+            << std::setw(12) << "shards" << std::setw(20) << "NONE (puts/s)" << std::setw(20) << "LOG (puts/s)" << '\n';
+  for (size_t s = 0; s < shard_counts.size(); ++s) {
+    std::cout << std::setw(12) << shard_counts[s] << std::fixed << std::setprecision(0);
+    for (const double put_rate : put_rates[s]) {
+      std::cout << std::setw(20) << put_rate;
+    }
+    std::cout << '\n';
+  }
+  std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+double time_random_gets(ConcurrentHashTable * hash_table, const std::vector<std::string> & keys)
+{
+  size_t total_length = 0;
+  const auto start_time = std::chrono::steady_clock::now();
+  for (const std::string & key : keys) {
+    total_length += hash_table->get(key).length();
+  }
+  const std::chrono::duration<double, std::nano> get_time = std::chrono::steady_clock::now() - start_time;
+  hash_sink = total_length;
+  return get_time.count() / keys.size();
+}
+
+// counts the data TLB misses of the calling thread while started, with perf_event_open()
+class TlbMissCounter
+{
+public:
+  TlbMissCounter()
+  {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    m_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  ~TlbMissCounter() { if (m_fd >= 0) { close(m_fd); } }
+
+  void start()
+  {
+    if (m_fd >= 0) {
+      ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  // -1 if the counter isn't available
+  int64_t stop()
+  {
+    uint64_t count;
+    if (m_fd < 0 || ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0) != 0 || read(m_fd, &count, sizeof(count)) != sizeof(count)) {
+      return -1;
+    }
+    return count;
+  }
+
+private:
+  int m_fd;
+};
+
+// random get()s with the store file and the index on normal pages and on transparent huge pages
+void benchmark_huge_pages()
+{
+  const std::vector<std::pair<FileBackedBuffer::Pages, const char *>> page_kinds = {
+    {FileBackedBuffer::Pages::NORMAL, "normal"},
+    {FileBackedBuffer::Pages::TRANSPARENT_HUGE, "huge"},
+  };
+
+  std::mt19937 generator;
+  std::uniform_int_distribution<size_t> random_key(0, NUM_KEYS - 1);
+  std::vector<std::string> keys(NUM_LOOKUPS_PER_RUN);
+  for (std::string & key : keys) {
+    key = make_key(random_key(generator));
+  }
+
+  std::vector<std::pair<double, int64_t>> results;
+  for (const auto & page_kind : page_kinds) {
+    ConcurrentHashTable * hash_table = new ConcurrentHashTable(ConcurrentHashTable::Durability::NONE,
+                                                               ConcurrentHashTable::Recovery::PARALLEL,
+                                                               page_kind.first);
+    populate(hash_table);
+    time_random_gets(hash_table, keys);  // fault everything in first
+
+    TlbMissCounter tlb_misses;
+    tlb_misses.start();
+    const double get_time = time_random_gets(hash_table, keys);
+    results.emplace_back(get_time, tlb_misses.stop());
+    delete hash_table;
+  }
+
+  std::cout << "\nrandom get() by the pages backing the store file and the index:\n";
+  for (size_t i = 0; i < page_kinds.size(); ++i) {
+    std::cout << std::setw(12) << page_kinds[i].second << std::setw(12) << std::fixed << std::setprecision(1) << results[i].first << " ns/get";
+    if (results[i].second >= 0) {
+      std::cout << std::setw(12) << std::setprecision(2) << static_cast<double>(results[i].second) / keys.size() << " dTLB misses/get";
+    } else {
+      std::cout << std::setw(12) << "n/a" << " dTLB misses/get";
+    }
+    std::cout << '\n';
+  }
+  std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+// get() latency right after a clean restart with the store file evicted from the page cache, with the used blocks
+// faulted in first and without
+void benchmark_warm_up()
+{
+  const std::vector<std::pair<FileBackedBuffer::Residency::WarmUp, const char *>> warm_ups = {
+    {FileBackedBuffer::Residency::WarmUp::NONE, "none"},
+    {FileBackedBuffer::Residency::WarmUp::POPULATE, "populate"},
+  };
+  constexpr size_t NUM_GETS = 100000;
+
+  std::mt19937 generator;
+  std::uniform_int_distribution<size_t> random_key(0, NUM_KEYS - 1);
+  std::vector<std::string> keys(NUM_GETS);
+  for (std::string & key : keys) {
+    key = make_key(random_key(generator));
+  }
+
+  ConcurrentHashTable * hash_table = new ConcurrentHashTable();
+  populate(hash_table);
+  delete hash_table;
+
+  std::cout << "\nget() latency after a restart with the store file evicted, by warm-up (us):\n"
+            << std::setw(12) << "" << std::setw(12) << "open" << std::setw(12) << "p50" << std::setw(12) << "p99"
+            << std::setw(12) << "max" << '\n';
+  for (const auto & warm_up : warm_ups) {
+    const int fd = open(ConcurrentHashTable::BUFFER_FILENAME, O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    const auto open_start_time = std::chrono::steady_clock::now();
+    hash_table = new ConcurrentHashTable();
+    FileBackedBuffer::Residency residency;
+    residency.warm_up = warm_up.first;
+    hash_table->set_residency(residency);
+    const std::chrono::duration<double, std::micro> open_time = std::chrono::steady_clock::now() - open_start_time;
+
+    std::vector<double> get_times; get_times.reserve(keys.size());
+    for (const std::string & key : keys) {
+      const auto start_time = std::chrono::steady_clock::now();
+      hash_sink = hash_table->get(key).length();
+      get_times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count());
+    }
+    std::sort(get_times.begin(), get_times.end());
+    std::cout << std::setw(12) << warm_up.second << std::fixed << std::setprecision(1) << std::setw(12) << open_time.count()
+              << std::setw(12) << get_times[get_times.size() / 2] << std::setw(12) << get_times[get_times.size() * 99 / 100]
+              << std::setw(12) << get_times.back() << '\n' << std::defaultfloat << std::setprecision(6);
+    delete hash_table;
+  }
+}
+
+// the cost of checking the checksum of every record read
+void benchmark_verified_reads(ConcurrentHashTable * hash_table)
+{
+  std::mt19937 generator;
+  std::uniform_int_distribution<size_t> random_key(0, NUM_KEYS - 1);
+  std::vector<std::string> keys(NUM_LOOKUPS_PER_RUN);
+  for (std::string & key : keys) {
+    key = make_key(random_key(generator));
+  }
+
+  const double unverified_time = time_random_gets(hash_table, keys);
+  hash_table->set_verify_reads(true);
+  const double verified_time = time_random_gets(hash_table, keys);
+  hash_table->set_verify_reads(false);
+  std::cout << "\nget() with and without checksum verification:\n"
+            << std::setw(12) << "unverified" << std::setw(12) << std::fixed << std::setprecision(1) << unverified_time << " ns/get\n"
+            << std::setw(12) << "verified" << std::setw(12) << verified_time << " ns/get\n"
+            << std::defaultfloat << std::setprecision(6);
+}
+
+int main()
+{
+  benchmark_durability();
+  benchmark_huge_pages();
+  benchmark_warm_up();
+  benchmark_sharding();
+  benchmark_allocator_and_reclamation_policies();
+
+  ConcurrentHashTable * hash_table = new ConcurrentHashTable();
+
+  populate(hash_table);
+  benchmark_multi_get(hash_table);
+  benchmark_hash_policies();
+  benchmark_verified_reads(hash_table);
+
+  std::cout << '\n';
+  hash_table->print_stats();
+
+  // purposely leak hash_table to simulate process crash
+
+  return 0;
+}
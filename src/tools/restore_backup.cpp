@@ -0,0 +1,13 @@
+#include <iostream>
+
+#include "file_backed_buffer.hpp"
+
+// rebuilds a store file from a directory of backups taken with backup_to()
+int main(int argc, char * argv[])
+{
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " <backup directory> <output file>\n";
+    return 2;
+  }
+  return FileBackedBuffer::restore_backup(argv[1], argv[2]) ? 0 : 1;
+}